@@ -0,0 +1,35 @@
+#include "bufpool.h"
+#include <stdlib.h>
+
+void bufferPoolInit(BufferPool *pool, size_t bufferSize) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->bufferSize = bufferSize;
+    pool->idleCount = 0;
+}
+
+void *bufferPoolGet(BufferPool *pool) {
+    void *buf = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->idleCount > 0) buf = pool->idle[--pool->idleCount];
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!buf && posix_memalign(&buf, BUFPOOL_ALIGN, pool->bufferSize) != 0) buf = NULL;
+    return buf;
+}
+
+void bufferPoolPut(BufferPool *pool, void *buf) {
+    if (!buf) return;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->idleCount < BUFPOOL_KEEP) {
+        pool->idle[pool->idleCount++] = buf;
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(buf);  // Pool already full
+}
+
+void bufferPoolDestroy(BufferPool *pool) {
+    for (int i = 0; i < pool->idleCount; i++) free(pool->idle[i]);
+    pool->idleCount = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
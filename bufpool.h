@@ -0,0 +1,23 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define BUFPOOL_ALIGN 4096  // Buffers are page aligned, which also satisfies O_DIRECT
+#define BUFPOOL_KEEP 16     // Idle buffers kept for reuse; extras are freed when returned
+
+// A thread-safe pool of equally sized, page-aligned buffers
+typedef struct {
+    pthread_mutex_t lock;
+    size_t bufferSize;
+    void *idle[BUFPOOL_KEEP];  // Buffers ready to be handed out again
+    int idleCount;
+} BufferPool;
+
+void bufferPoolInit(BufferPool *pool, size_t bufferSize);
+void *bufferPoolGet(BufferPool *pool);            // Returns NULL if a new buffer could not be allocated
+void bufferPoolPut(BufferPool *pool, void *buf);  // Give a buffer back (NULL is ignored)
+void bufferPoolDestroy(BufferPool *pool);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+// Running SHA-256 state
+typedef struct {
+    uint32_t state[8];
+    uint8_t buffer[64];   // Partial block waiting for more input
+    uint64_t length;      // Total bytes hashed so far
+} Sha256Ctx;
+
+// CRC32C (Castagnoli). Start with crc = 0 and feed the result back in to continue a running checksum.
+// Uses the SSE4.2 crc32 instruction when the CPU has it.
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+// SHA-256. Uses the SHA extensions when the CPU has them.
+void sha256Init(Sha256Ctx *ctx);
+void sha256Update(Sha256Ctx *ctx, const void *data, size_t len);
+void sha256Final(Sha256Ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,123 @@
+#include "command.h"
+#include "hexdump.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COMMAND_LINE_MAX 1024
+
+static double elapsedMs(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Parse a decimal or 0x-prefixed number; false if the token is missing, empty, negative or malformed
+bool parseNumber(const char *token, uint64_t *value) {
+    if (!token || *token == '\0' || *token == '-') return false;
+    char *end;
+    errno = 0;
+    *value = strtoull(token, &end, 0);
+    return *end == '\0' && errno == 0;
+}
+
+static bool commandBlock(struct Ext2File *f, char *arg) {
+    uint64_t blockNum;
+    if (!parseNumber(arg, &blockNum) || blockNum >= f->superblock.s_blocks_count) {
+        printf("Usage: block N (0 <= N < %u)\n", f->superblock.s_blocks_count);
+        return false;
+    }
+    uint8_t *buf = bufferPoolGet(&f->blockPool);
+    if (!buf) return false;
+    bool ok = fetchBlock(f, (uint32_t)blockNum, buf);
+    if (ok) displayBuffer(buf, f->blockSize, blockNum * f->blockSize);
+    bufferPoolPut(&f->blockPool, buf);
+    return ok;
+}
+
+// dump disk|part|block START LENGTH, streamed from the image through the buffered hexdump engine
+static bool commandDump(struct Ext2File *f, char *spaceArg, char *startArg, char *lengthArg) {
+    HexdumpSpace space;
+    uint64_t start, length;
+    if (!spaceArg || !parseHexdumpSpace(spaceArg, &space) || !parseNumber(startArg, &start) ||
+        !parseNumber(lengthArg, &length) || length == 0) {
+        printf("Usage: dump disk|part|block START LENGTH (LENGTH in blocks for block)\n");
+        return false;
+    }
+    return hexdumpRange(f, space, start, length, STDOUT_FILENO);
+}
+
+// Write a snapshot's overlay back into the image
+static bool commandCommit(struct Ext2File *f) {
+    int pages = vdiCommitOverlay(f->partition->vdi);
+    if (pages < 0) return false;
+    printf("Committed %d pages\n", pages);
+    return true;
+}
+
+static void commandHelp(void) {
+    printf("Commands:\n");
+    printf("  superblock              Display the superblock\n");
+    printf("  bgdt                    Display the block group descriptor table\n");
+    printf("  block N                 Hexdump file system block N\n");
+    printf("  hexdump OFFSET LENGTH   Hexdump a byte range of the partition\n");
+    printf("  dump disk|part|block START LENGTH\n");
+    printf("                          Hexdump a disk, partition or block range (LENGTH in blocks for block)\n");
+    printf("  overlay                 Count the pages a snapshot has written to its overlay\n");
+    printf("  commit                  Write a snapshot's overlay back into the image\n");
+    printf("  help                    List the commands\n");
+    printf("  quit                    Stop reading commands\n");
+}
+
+int runCommands(struct Ext2File *f, FILE *in) {
+    char line[COMMAND_LINE_MAX];
+    int failed = 0, run = 0;
+    double totalMs = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        char *save;
+        char *cmd = strtok_r(line, " \t\r\n", &save);
+        if (!cmd || cmd[0] == '#') continue;  // Blank line or comment
+        char *arg1 = strtok_r(NULL, " \t\r\n", &save);
+        char *arg2 = strtok_r(NULL, " \t\r\n", &save);
+        char *arg3 = strtok_r(NULL, " \t\r\n", &save);
+
+        if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) break;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool ok = true;
+        if (strcmp(cmd, "superblock") == 0) {
+            displaySuperblock(&f->superblock);
+        } else if (strcmp(cmd, "bgdt") == 0) {
+            displayBGDT(f->bgdt, f->numBlockGroups);
+        } else if (strcmp(cmd, "block") == 0) {
+            ok = commandBlock(f, arg1);
+        } else if (strcmp(cmd, "hexdump") == 0) {
+            ok = commandDump(f, "part", arg1, arg2);
+        } else if (strcmp(cmd, "dump") == 0) {
+            ok = commandDump(f, arg1, arg2, arg3);
+        } else if (strcmp(cmd, "overlay") == 0) {
+            printf("%u pages in overlay\n", vdiOverlayPages(f->partition->vdi));
+        } else if (strcmp(cmd, "commit") == 0) {
+            ok = commandCommit(f);
+        } else if (strcmp(cmd, "help") == 0) {
+            commandHelp();
+        } else {
+            printf("Unknown command: %s (try help)\n", cmd);
+            ok = false;
+        }
+        fflush(stdout);
+
+        double ms = elapsedMs(&start);
+        totalMs += ms;
+        run++;
+        if (!ok) failed++;
+        fprintf(stderr, "[%s%s %.3f ms]\n", cmd, ok ? "" : " failed", ms);
+    }
+
+    fprintf(stderr, "[%d commands, %d failed, %.3f ms total]\n", run, failed, totalMs);
+    return failed;
+}
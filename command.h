@@ -0,0 +1,25 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "ext2.h"
+#include <stdio.h>
+
+// Read commands one per line from in and run them against an already open file system,
+// reporting how long each one took. Returns the number of commands that failed.
+//
+//   superblock              Display the superblock
+//   bgdt                    Display the block group descriptor table
+//   block N                 Hexdump file system block N
+//   hexdump OFFSET LENGTH   Hexdump a byte range of the partition (same as dump part)
+//   dump disk|part|block START LENGTH
+//                           Hexdump a disk, partition or block range; identical lines are collapsed
+//   overlay                 Count the pages a snapshot has written to its overlay
+//   commit                  Write a snapshot's overlay back into the image (vdiCommitOverlay)
+//   help                    List the commands
+//   quit                    Stop reading commands
+int runCommands(struct Ext2File *f, FILE *in);
+
+// Parse a decimal or 0x-prefixed unsigned number; false if the token is missing or malformed
+bool parseNumber(const char *token, uint64_t *value);
+
+#endif
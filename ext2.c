@@ -11,45 +11,62 @@
 #define EXT2_PARTITION_TYPE 0x83  // Define ext2 partition type
 
 struct Ext2File *openExt2(char *fn) {
-    struct Ext2File *ext2 = malloc(sizeof(struct Ext2File));
-    if (!ext2) {
-        perror("Failed to allocate memory for Ext2File");
+    return openExt2Flags(fn, 0);
+}
+
+// Open with VDI_OPEN_* options passed down to the VDI layer
+struct Ext2File *openExt2Flags(char *fn, int vdiFlags) {
+    VDIFile *vdi = vdiOpenFlags(fn, vdiFlags);
+    if (!vdi) {
+        perror("Failed to open VDI file");
         return NULL;
     }
+    struct Ext2File *ext2 = openExt2OnImage(vdi, -1);
+    vdiClose(vdi);  // The file system's partition keeps its own reference
+    return ext2;
+}
 
-    ext2->partition = openPartition(fn, 0);
-    if (!ext2->partition) {
-        perror("Failed to open MBR partition");
-        free(ext2);
+// Open the file system in partition part (-1 = first partition of type 0x83) of an open VDI.
+// Several file systems on one image share its fd and translation map.
+struct Ext2File *openExt2OnImage(VDIFile *vdi, int part) {
+    struct Ext2File *ext2 = malloc(sizeof(struct Ext2File));
+    if (!ext2) {
+        perror("Failed to allocate memory for Ext2File");
         return NULL;
     }
 
-    int partIndex; // -1
-    for (int i = 0; i < 4; ++i) {
-        MBRPartitionEntry *entry = (MBRPartitionEntry *)(ext2->partition->partitionTable + i * sizeof(MBRPartitionEntry));
-        if (entry->partitionType == EXT2_PARTITION_TYPE) {
-            partIndex = i;
-            break;
+    int partIndex = part;
+    if (partIndex < 0) {
+        uint8_t table[64];
+        if (vdiReadAt(vdi, table, sizeof(table), 446) != sizeof(table)) {
+            printf("Failed to read the MBR partition table.\n");
+            free(ext2);
+            return NULL;
+        }
+        for (int i = 0; i < 4; ++i) {
+            MBRPartitionEntry *entry = (MBRPartitionEntry *)(table + i * sizeof(MBRPartitionEntry));
+            if (entry->partitionType == EXT2_PARTITION_TYPE) {
+                partIndex = i;
+                break;
+            }
         }
     }
 
     if (partIndex < 0) {
         printf("No ext2 partition of type 0x%02X found.\n", EXT2_PARTITION_TYPE);
-        closePartition(ext2->partition);
         free(ext2);
         return NULL;
     }
 
-    // Open the ext2 partition
-    struct Partition *tempPartition = openPartition(fn, partIndex);
-    if (!tempPartition) {
+    // Open a view of the ext2 partition on the shared image
+    ext2->partition = openPartitionOnImage(vdi, partIndex);
+    if (!ext2->partition) {
         printf("Error in openExt2: Failed to open partition %d.\n", partIndex);
         free(ext2);
         return NULL;
     }
-    ext2->partition = tempPartition;
 
-    off_t superblockOffset = ext2->partition->startSector * SECTOR_SIZE + EXT2_SUPERBLOCK_OFFSET;
+    off_t superblockOffset = EXT2_SUPERBLOCK_OFFSET;  // Partition relative; the partition adds its own start
 
     if (vdiSeekPartition(ext2->partition, superblockOffset, SEEK_SET) != superblockOffset) {
         printf("Failed to seek to superblock in partition %d.\n", partIndex);
@@ -61,8 +78,7 @@ struct Ext2File *openExt2(char *fn) {
     if (!fetchSuperblock(ext2, 0, &ext2->superblock)) {
         printf("Failed to fetch the superblock in partition %d.\n", partIndex);
         closePartition(ext2->partition);
-        free(ext2->bgdt); // Free bgdt if allocated
-        free(ext2);       // Free ext2
+        free(ext2);
         return NULL;
     }
 
@@ -74,12 +90,16 @@ struct Ext2File *openExt2(char *fn) {
     }
 
     ext2->blockSize = 1024 << ext2->superblock.s_log_block_size;
-    ext2->numBlockGroups = (ext2->superblock.s_blocks_count + ext2->superblock.s_blocks_per_group - 1) / ext2->superblock.s_blocks_per_group;
+    // In 64 bits: the rounding-up sum wraps when s_blocks_count is within a group of 2^32
+    ext2->numBlockGroups = ((uint64_t)ext2->superblock.s_blocks_count + ext2->superblock.s_blocks_per_group - 1) / ext2->superblock.s_blocks_per_group;
+    ext2->inodeSize = (ext2->superblock.s_rev_level == 0) ? 128 : ext2->superblock.s_inode_size;
+    bufferPoolInit(&ext2->blockPool, ext2->blockSize);
 
     ext2->bgdt = malloc(ext2->numBlockGroups * sizeof(Ext2BlockGroupDescriptor));
     if (!ext2->bgdt) {
         printf("Failed to allocate memory for block group descriptor table.\n");
         closePartition(ext2->partition);
+        bufferPoolDestroy(&ext2->blockPool);
         free(ext2);
         return NULL;
     }
@@ -88,6 +108,7 @@ struct Ext2File *openExt2(char *fn) {
     if (!fetchBGDT(ext2, bgdt_block, ext2->bgdt)) {
         printf("Failed to fetch block group descriptor table.\n");
         closePartition(ext2->partition);
+        bufferPoolDestroy(&ext2->blockPool);
         free(ext2->bgdt);
         free(ext2);
         return NULL;
@@ -99,26 +120,26 @@ struct Ext2File *openExt2(char *fn) {
 void closeExt2(struct Ext2File *f) {
     if (f) {
         closePartition(f->partition);
+        bufferPoolDestroy(&f->blockPool);
         free(f->bgdt);
         free(f);
     }
 }
 
+// Block numbers are absolute, matching the ones stored in the BGDT and in inodes: the main superblock
+// is in block s_first_data_block (1 on 1KB file systems, 0 otherwise), not necessarily block 0.
+// The read does not use the partition cursor, so several threads may fetch blocks at once.
 bool fetchBlock(struct Ext2File *f, uint32_t blockNum, void *buf) {
-    uint64_t offset = (blockNum + f->superblock.s_first_data_block) * f->blockSize;
-    if (vdiSeekPartition(f->partition, offset, SEEK_SET) != offset) {
-        printf("Failed to seek to block %u\n", blockNum);
-        return false;
-    }
-    if (vdiReadPartition(f->partition, buf, f->blockSize) != f->blockSize) {
-        printf("Failed to read block %u\n", blockNum);
+    off_t offset = (off_t)blockNum * f->blockSize;
+    if (vdiReadPartitionAt(f->partition, buf, f->blockSize, offset) != f->blockSize) {
+        fprintf(stderr, "Failed to read block %u\n", blockNum);
         return false;
     }
     return true;
 }
 
 bool writeBlock(struct Ext2File *f, uint32_t blockNum, void *buf) {
-    off_t offset = (blockNum + f->superblock.s_first_data_block) * f->blockSize;
+    off_t offset = (off_t)blockNum * f->blockSize;
     if (vdiSeekPartition(f->partition, offset, SEEK_SET) != offset) {
         printf("Failed to seek to block %u for writing\n", blockNum);
         return false;
@@ -142,14 +163,8 @@ bool fetchSuperblock(struct Ext2File *f, uint32_t blockNum, Ext2Superblock *sb)
             return false;
         }
     } else {
-        // For backup superblocks, calculate the offset based on block size
-        uint32_t blockSize = 1024 << sb->s_log_block_size;
-        if (blockNum > 0) {
-            blockNum++;
-        }
-
-        // Seek and read the backup superblock directly
-        off_t offset = blockNum * blockSize;
+        // Backup superblocks start their block; blockNum is absolute, as listed by the BGDT layout
+        off_t offset = (off_t)blockNum * f->blockSize;
         if (vdiSeekPartition(f->partition, offset, SEEK_SET) != offset) {
             printf("Failed to seek to backup superblock at block %u\n", blockNum);
             return false;
@@ -180,79 +195,202 @@ bool writeSuperblock(struct Ext2File *f, uint32_t blockNum, Ext2Superblock *sb)
         }
     } else {
         uint32_t blockSize = f->blockSize;
-        if (blockSize == 1024 && blockNum > 0) {
-            blockNum++;
-        }
-        uint8_t *buf = (uint8_t *)malloc(blockSize);
+        uint8_t *buf = bufferPoolGet(&f->blockPool);
         if (!buf) {
             printf("Failed to allocate buffer for backup superblock\n");
             return false;
         }
+        memset(buf, 0, blockSize);
         memcpy(buf, sb, sizeof(Ext2Superblock));
 
         if (!writeBlock(f, blockNum, buf)) {
             printf("Failed to write backup superblock\n");
-            free(buf);
+            bufferPoolPut(&f->blockPool, buf);
             return false;
         }
 
-        uint8_t *verifyBuf = malloc(blockSize);
-        if (!verifyBuf) {
-            printf("Failed to allocate buffer for verification\n");
-            free(buf);
-            return false;
-        }
-
-        if (!fetchBlock(f, blockNum, verifyBuf)) {
+        // Read it back into the same buffer to verify
+        if (!fetchBlock(f, blockNum, buf)) {
             printf("Failed to read back backup superblock for verification\n");
-            free(buf);
-            free(verifyBuf);
+            bufferPoolPut(&f->blockPool, buf);
             return false;
         }
 
         Ext2Superblock verifySB;
-        memcpy(&verifySB, verifyBuf, sizeof(Ext2Superblock));
-        free(verifyBuf);
+        memcpy(&verifySB, buf, sizeof(Ext2Superblock));
+        bufferPoolPut(&f->blockPool, buf);
 
         if (verifySB.s_magic != EXT2_MAGIC_NUMBER) {
             printf("Invalid backup superblock after writing: 0x%x\n", verifySB.s_magic);
-            free(buf);
             return false;
         }
-        free(buf);
     }
     return true;
 }
 
+// The table spans as many blocks as the group count needs (large file systems have thousands of groups)
 bool fetchBGDT(struct Ext2File *f, uint32_t blockNum, Ext2BlockGroupDescriptor *bgdt) {
-    uint8_t *buffer = malloc(f->blockSize);
+    uint8_t *buffer = bufferPoolGet(&f->blockPool);
     if (!buffer) return false;
 
-    if (!fetchBlock(f, blockNum, buffer)) {
-        printf("Failed to fetch Block Group Descriptor Table at block %u\n", blockNum);
-        free(buffer); // Free the buffer on error
-        return false;
+    uint8_t *dest = (uint8_t *)bgdt;
+    size_t remaining = (size_t)f->numBlockGroups * sizeof(Ext2BlockGroupDescriptor);
+    for (uint32_t b = blockNum; remaining > 0; b++) {
+        if (!fetchBlock(f, b, buffer)) {
+            printf("Failed to fetch Block Group Descriptor Table at block %u\n", b);
+            bufferPoolPut(&f->blockPool, buffer); // Return the buffer on error
+            return false;
+        }
+        size_t chunk = (remaining < f->blockSize) ? remaining : f->blockSize;
+        memcpy(dest, buffer, chunk);
+        dest += chunk;
+        remaining -= chunk;
     }
-
-    memcpy(bgdt, buffer, f->numBlockGroups * sizeof(Ext2BlockGroupDescriptor));
-    free(buffer); // Free the buffer after use
+    bufferPoolPut(&f->blockPool, buffer); // Return the buffer after use
 
     return true;
 }
 
 bool writeBGDT(struct Ext2File *f, uint32_t blockNum, Ext2BlockGroupDescriptor *bgdt) {
-    uint8_t *buffer = malloc(f->blockSize);
+    uint8_t *buffer = bufferPoolGet(&f->blockPool);
     if (!buffer) return false;
 
-    memset(buffer, 0, f->blockSize);
-    memcpy(buffer, bgdt, f->numBlockGroups * sizeof(Ext2BlockGroupDescriptor));
-
-    bool result = writeBlock(f, blockNum, buffer);
-    free(buffer);
+    const uint8_t *src = (const uint8_t *)bgdt;
+    size_t remaining = (size_t)f->numBlockGroups * sizeof(Ext2BlockGroupDescriptor);
+    bool result = true;
+    for (uint32_t b = blockNum; remaining > 0 && result; b++) {
+        size_t chunk = (remaining < f->blockSize) ? remaining : f->blockSize;
+        memset(buffer, 0, f->blockSize);
+        memcpy(buffer, src, chunk);
+        result = writeBlock(f, b, buffer);
+        src += chunk;
+        remaining -= chunk;
+    }
+    bufferPoolPut(&f->blockPool, buffer);
 
     return result;
 }
 
+// Read inode iNum (numbered from 1) straight out of its group's inode table
+bool fetchInode(struct Ext2File *f, uint32_t iNum, Ext2Inode *buf) {
+    if (iNum == 0 || iNum > f->superblock.s_inodes_count) {
+        fprintf(stderr, "Invalid inode number %u\n", iNum);
+        return false;
+    }
+
+    uint32_t group = (iNum - 1) / f->superblock.s_inodes_per_group;
+    uint32_t index = (iNum - 1) % f->superblock.s_inodes_per_group;
+    off_t offset = (off_t)f->bgdt[group].bg_inode_table * f->blockSize + (off_t)index * f->inodeSize;
+
+    if (vdiReadPartitionAt(f->partition, buf, sizeof(Ext2Inode), offset) != sizeof(Ext2Inode)) {
+        fprintf(stderr, "Failed to read inode %u\n", iNum);
+        return false;
+    }
+    return true;
+}
+
+// Read logical block bNum of a file, following indirect blocks as needed; holes read back as zeros
+bool fetchBlockFromFile(struct Ext2File *f, Ext2Inode *inode, uint32_t bNum, void *buf) {
+    uint32_t k = f->blockSize / 4;  // Block numbers per indirect block
+    uint32_t blockNum;
+
+    if (bNum < EXT2_NDIR_BLOCKS) {
+        blockNum = inode->i_block[bNum];
+    } else {
+        uint32_t *indirect = bufferPoolGet(&f->blockPool);
+        if (!indirect) return false;
+
+        uint32_t depth, start;
+        bNum -= EXT2_NDIR_BLOCKS;
+        if (bNum < k) {
+            depth = 1; start = inode->i_block[12];
+        } else if ((bNum -= k) < (uint64_t)k * k) {
+            depth = 2; start = inode->i_block[13];
+        } else {
+            bNum -= k * k;
+            depth = 3; start = inode->i_block[14];
+        }
+
+        // Walk down the tree one level at a time
+        blockNum = start;
+        for (uint32_t level = depth; level > 0 && blockNum != 0; level--) {
+            uint64_t span = 1;
+            for (uint32_t i = 1; i < level; i++) span *= k;
+            if (!fetchBlock(f, blockNum, indirect)) {
+                bufferPoolPut(&f->blockPool, indirect);
+                return false;
+            }
+            blockNum = indirect[bNum / span];
+            bNum %= span;
+        }
+        bufferPoolPut(&f->blockPool, indirect);
+    }
+
+    if (blockNum == 0) {
+        memset(buf, 0, f->blockSize);  // Sparse hole
+        return true;
+    }
+    return fetchBlock(f, blockNum, buf);
+}
+
+// Append the data block numbers found below an indirect block of the given depth (0 = a data block itself)
+static bool collectBlocks(struct Ext2File *f, uint32_t blockNum, int depth, uint32_t *list, uint32_t *count, uint32_t total) {
+    uint32_t k = f->blockSize / 4;
+    if (blockNum == 0) {
+        uint64_t span = 1;
+        for (int i = 0; i < depth; i++) span *= k;
+        for (uint64_t i = 0; i < span && *count < total; i++) list[(*count)++] = 0; // Whole subtree is a hole
+        return true;
+    }
+    if (depth == 0) {
+        list[(*count)++] = blockNum;
+        return true;
+    }
+
+    uint32_t *indirect = bufferPoolGet(&f->blockPool);
+    if (!indirect) return false;
+    if (!fetchBlock(f, blockNum, indirect)) {
+        bufferPoolPut(&f->blockPool, indirect);
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i < k && *count < total && ok; i++) {
+        ok = collectBlocks(f, indirect[i], depth - 1, list, count, total);
+    }
+    bufferPoolPut(&f->blockPool, indirect);
+    return ok;
+}
+
+// Build the list of block numbers backing a file, one per logical block (0 for holes).
+// Each indirect block is read once, unlike calling fetchBlockFromFile() per block. Caller frees the list.
+uint32_t *fetchBlockList(struct Ext2File *f, Ext2Inode *inode, uint32_t *count) {
+    uint32_t total = (fileSize(inode) + f->blockSize - 1) / f->blockSize;
+    uint32_t *list = malloc((total ? total : 1) * sizeof(uint32_t));
+    if (!list) {
+        fprintf(stderr, "Failed to allocate block list\n");
+        return NULL;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < EXT2_NDIR_BLOCKS && n < total; i++) list[n++] = inode->i_block[i];
+    for (int depth = 1; depth <= 3 && n < total; depth++) {
+        if (!collectBlocks(f, inode->i_block[EXT2_NDIR_BLOCKS + depth - 1], depth, list, &n, total)) {
+            fprintf(stderr, "Failed to read indirect blocks\n");
+            free(list);
+            return NULL;
+        }
+    }
+    *count = n;
+    return list;
+}
+
+// Full 64-bit size of a file (i_dir_acl holds the upper half for regular files)
+uint64_t fileSize(Ext2Inode *inode) {
+    uint64_t size = inode->i_size;
+    if ((inode->i_mode & EXT2_S_IFMT) == EXT2_S_IFREG) size |= (uint64_t)inode->i_dir_acl << 32;
+    return size;
+}
+
 // Function to display the contents of the superblock
 void displaySuperblock(Ext2Superblock *sb) {
     printf("Superblock contents:\n"); // Print header for superblock display
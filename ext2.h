@@ -3,10 +3,17 @@
 
 #include "partition.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 #define EXT2_SUPERBLOCK_OFFSET 1024  // Offset of the superblock in bytes
 #define EXT2_SUPERBLOCK_SIZE sizeof(Ext2Superblock)  // Size of the superblock structure
 #define EXT2_SUPER_MAGIC 0xEF53
+#define EXT2_ROOT_INO 2  // Inode number of the root directory
+#define EXT2_NDIR_BLOCKS 12  // Number of direct block pointers in an inode
+#define EXT2_S_IFMT  0xF000  // Mask for the file type bits of i_mode
+#define EXT2_S_IFDIR 0x4000  // Directory
+#define EXT2_S_IFREG 0x8000  // Regular file
+#define EXT2_S_IFLNK 0xA000  // Symbolic link
 
 typedef struct {
     uint32_t s_inodes_count;
@@ -70,16 +77,49 @@ typedef struct {
     uint32_t bg_reserved[3];
 } Ext2BlockGroupDescriptor;
 
+typedef struct {
+    uint16_t i_mode;
+    uint16_t i_uid;
+    uint32_t i_size;
+    uint32_t i_atime;
+    uint32_t i_ctime;
+    uint32_t i_mtime;
+    uint32_t i_dtime;
+    uint16_t i_gid;
+    uint16_t i_links_count;
+    uint32_t i_blocks;       // Count of 512-byte sectors, not file system blocks
+    uint32_t i_flags;
+    uint32_t i_osd1;
+    uint32_t i_block[15];    // 12 direct, then single, double and triple indirect
+    uint32_t i_generation;
+    uint32_t i_file_acl;
+    uint32_t i_dir_acl;      // Upper 32 bits of the size for regular files
+    uint32_t i_faddr;
+    uint8_t  i_osd2[12];
+} Ext2Inode;
+
+typedef struct {
+    uint32_t inode;
+    uint16_t rec_len;
+    uint8_t  name_len;
+    uint8_t  file_type;
+    char     name[];
+} Ext2DirEntry;
+
 struct Ext2File {
     int fd;
     MBRPartition *partition;
     uint32_t blockSize;
     uint32_t numBlockGroups;
+    uint32_t inodeSize;
+    BufferPool blockPool;  // Reusable page-aligned block buffers
     Ext2Superblock superblock;
     Ext2BlockGroupDescriptor *bgdt;
 };
 
 struct Ext2File *openExt2(char *fn);
+struct Ext2File *openExt2Flags(char *fn, int vdiFlags);
+struct Ext2File *openExt2OnImage(VDIFile *vdi, int part);  // part -1 = first ext2 partition; takes a reference to vdi
 void closeExt2(struct Ext2File *f);
 static bool isValidSuperblock(Ext2Superblock *sb);
 bool fetchBlock(struct Ext2File *f, uint32_t blockNum, void *buf);
@@ -88,6 +128,10 @@ bool fetchSuperblock(struct Ext2File *f, uint32_t blockNum, Ext2Superblock *sb);
 bool writeSuperblock(struct Ext2File *f, uint32_t blockNum, Ext2Superblock *sb);
 bool fetchBGDT(struct Ext2File *f, uint32_t blockNum, Ext2BlockGroupDescriptor *bgdt);
 bool writeBGDT(struct Ext2File *f, uint32_t blockNum, Ext2BlockGroupDescriptor *bgdt);
+bool fetchInode(struct Ext2File *f, uint32_t iNum, Ext2Inode *buf);
+bool fetchBlockFromFile(struct Ext2File *f, Ext2Inode *inode, uint32_t bNum, void *buf);
+uint32_t *fetchBlockList(struct Ext2File *f, Ext2Inode *inode, uint32_t *count);
+uint64_t fileSize(Ext2Inode *inode);
 void displaySuperblock(Ext2Superblock *sb);
 void displayBGDT(Ext2BlockGroupDescriptor *bgdt, uint32_t numBlockGroups);
 
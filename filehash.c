@@ -0,0 +1,255 @@
+#include "filehash.h"
+#include "checksum.h"
+#include "walk.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HASH_RUN_SIZE (1 << 20)  // Largest single read of contiguous data blocks
+
+typedef struct {
+    char *path;
+    uint32_t iNum;
+    Ext2Inode inode;
+    uint8_t sha[SHA256_DIGEST_SIZE];
+    uint32_t crc;
+    bool ok;
+    size_t primary;         // Entry whose hash this one shares: itself, or the first path of the same inode
+} HashEntry;
+
+typedef struct {
+    struct Ext2File *f;
+    pthread_mutex_t lock;   // Guards the entry list while the tree is being walked
+    HashEntry *entries;
+    size_t count;
+    size_t capacity;
+    size_t *todo;           // Entries to hash: one per inode, so hard links are read once
+    size_t numTodo;
+    atomic_size_t next;     // Next todo slot to be claimed by a worker
+    bool failed;
+} HashJob;
+
+// Walk visitor: remember every regular file
+static void collectFile(void *arg, const char *path, uint32_t iNum, Ext2Inode *inode) {
+    HashJob *job = (HashJob *)arg;
+    if ((inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFREG) return;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->count == job->capacity) {
+        size_t newCap = job->capacity ? job->capacity * 2 : 256;
+        HashEntry *entries = realloc(job->entries, newCap * sizeof(HashEntry));
+        if (!entries) {
+            job->failed = true;
+            pthread_mutex_unlock(&job->lock);
+            return;
+        }
+        job->entries = entries;
+        job->capacity = newCap;
+    }
+    HashEntry *e = &job->entries[job->count];
+    e->path = strdup(path);
+    e->iNum = iNum;
+    e->inode = *inode;
+    e->ok = false;
+    if (e->path) job->count++;
+    else job->failed = true;
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Hash one file, reading runs of physically contiguous blocks with a single call each
+static bool hashFile(struct Ext2File *f, HashEntry *e, uint8_t *run) {
+    uint32_t numBlocks;
+    uint32_t *blocks = fetchBlockList(f, &e->inode, &numBlocks);
+    if (!blocks) return false;
+
+    Sha256Ctx sha;
+    sha256Init(&sha);
+    uint32_t crc = 0;
+    uint64_t remaining = fileSize(&e->inode);
+    uint32_t maxRun = HASH_RUN_SIZE / f->blockSize;
+    bool ok = true;
+
+    for (uint32_t i = 0; i < numBlocks && ok; ) {
+        uint32_t len = 1;
+        if (blocks[i] == 0) {
+            while (i + len < numBlocks && blocks[i + len] == 0 && len < maxRun) len++;
+            memset(run, 0, (size_t)len * f->blockSize);  // Holes hash as zeros
+        } else {
+            while (i + len < numBlocks && blocks[i + len] == blocks[i] + len && len < maxRun) len++;
+            size_t bytes = (size_t)len * f->blockSize;
+            if (vdiReadPartitionAt(f->partition, run, bytes, (off_t)blocks[i] * f->blockSize) != (ssize_t)bytes) {
+                fprintf(stderr, "Failed to read blocks %u-%u of inode %u\n", blocks[i], blocks[i] + len - 1, e->iNum);
+                ok = false;
+                break;
+            }
+        }
+
+        size_t use = (size_t)len * f->blockSize;
+        if (use > remaining) use = remaining;  // The last block is only partly file data
+        sha256Update(&sha, run, use);
+        crc = crc32c(crc, run, use);
+        remaining -= use;
+        i += len;
+    }
+    free(blocks);
+
+    sha256Final(&sha, e->sha);
+    e->crc = crc;
+    return ok;
+}
+
+static void *hashWorker(void *arg) {
+    HashJob *job = (HashJob *)arg;
+    uint8_t *run = malloc(HASH_RUN_SIZE);
+    if (!run) return NULL;  // Entries this worker would have taken are picked up by the others
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->numTodo) break;
+        HashEntry *e = &job->entries[job->todo[i]];
+        e->ok = hashFile(job->f, e, run);
+    }
+    free(run);
+    return NULL;
+}
+
+static int compareByPath(const void *a, const void *b) {
+    return strcmp(((const HashEntry *)a)->path, ((const HashEntry *)b)->path);
+}
+
+// Order entries by inode, then path, so the names of one hard-linked file end up next to each other
+static int compareByInode(const void *a, const void *b) {
+    const HashEntry *x = *(const HashEntry * const *)a;
+    const HashEntry *y = *(const HashEntry * const *)b;
+    if (x->iNum != y->iNum) return (x->iNum < y->iNum) ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+// Order entries so identical contents end up next to each other
+static int compareByContent(const void *a, const void *b) {
+    const HashEntry *x = *(const HashEntry * const *)a;
+    const HashEntry *y = *(const HashEntry * const *)b;
+    uint64_t sx = fileSize((Ext2Inode *)&x->inode), sy = fileSize((Ext2Inode *)&y->inode);
+    if (sx != sy) return (sx < sy) ? -1 : 1;
+    int c = memcmp(x->sha, y->sha, SHA256_DIGEST_SIZE);
+    return c ? c : strcmp(x->path, y->path);
+}
+
+static void printDigest(FILE *out, const uint8_t *sha) {
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) fprintf(out, "%02x", sha[i]);
+}
+
+bool hashExt2Files(struct Ext2File *f, int numThreads, FILE *out) {
+    if (numThreads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = (cores > 0) ? (int)cores : 1;
+    }
+
+    HashJob job = { .f = f };
+    pthread_mutex_init(&job.lock, NULL);
+    atomic_init(&job.next, 0);
+
+    bool ok = walkExt2Visit(f, numThreads, collectFile, &job) && !job.failed;
+    qsort(job.entries, job.count, sizeof(HashEntry), compareByPath);
+
+    // Group the paths by inode: only the first name of a hard-linked file is hashed, the others share it
+    HashEntry **byInode = malloc((job.count ? job.count : 1) * sizeof(HashEntry *));
+    job.todo = malloc((job.count ? job.count : 1) * sizeof(size_t));
+    if (!byInode || !job.todo) {
+        fprintf(stderr, "Failed to allocate the hash work list\n");
+        free(byInode);
+        free(job.todo);
+        for (size_t i = 0; i < job.count; i++) free(job.entries[i].path);
+        free(job.entries);
+        pthread_mutex_destroy(&job.lock);
+        return false;
+    }
+    for (size_t i = 0; i < job.count; i++) byInode[i] = &job.entries[i];
+    qsort(byInode, job.count, sizeof(HashEntry *), compareByInode);
+    for (size_t i = 0; i < job.count; ) {
+        size_t j = i + 1;
+        while (j < job.count && byInode[j]->iNum == byInode[i]->iNum) j++;
+        size_t primary = byInode[i] - job.entries;
+        for (size_t k = i; k < j; k++) byInode[k]->primary = primary;
+        job.todo[job.numTodo++] = primary;
+        i = j;
+    }
+
+    // Hash the files in parallel, each worker claiming the next unhashed file
+    pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; threads && i < numThreads; i++) {
+        if (pthread_create(&threads[i], NULL, hashWorker, &job) != 0) break;
+        started++;
+    }
+    if (started == 0) hashWorker(&job);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    free(job.todo);
+
+    for (size_t i = 0; i < job.count; i++) {
+        HashEntry *e = &job.entries[i], *p = &job.entries[e->primary];
+        if (p == e) continue;
+        memcpy(e->sha, p->sha, SHA256_DIGEST_SIZE);
+        e->crc = p->crc;
+        e->ok = p->ok;
+    }
+
+    for (size_t i = 0; i < job.count; i++) {
+        HashEntry *e = &job.entries[i];
+        if (!e->ok) {
+            fprintf(out, "%-64s  %-8s  %llu  %s\n", "ERROR", "", (unsigned long long)fileSize(&e->inode), e->path);
+            ok = false;
+            continue;
+        }
+        printDigest(out, e->sha);
+        fprintf(out, "  %08x  %llu  %s\n", e->crc, (unsigned long long)fileSize(&e->inode), e->path);
+    }
+
+    // Report groups of non-empty files with the same size and digest; a hard-linked file counts once
+    HashEntry **order = malloc((job.count ? job.count : 1) * sizeof(HashEntry *));
+    if (order) {
+        size_t n = 0;
+        for (size_t i = 0; i < job.count; i++) {
+            HashEntry *e = &job.entries[i];
+            if (e->ok && e->primary == i && fileSize(&e->inode) > 0) order[n++] = e;
+        }
+        qsort(order, n, sizeof(HashEntry *), compareByContent);
+
+        for (size_t i = 0; i < n; ) {
+            size_t j = i + 1;
+            while (j < n && fileSize(&order[j]->inode) == fileSize(&order[i]->inode) &&
+                   memcmp(order[j]->sha, order[i]->sha, SHA256_DIGEST_SIZE) == 0) j++;
+            if (j - i > 1) {
+                fprintf(out, "\nDuplicate content (%zu files, %llu bytes each): ", j - i,
+                        (unsigned long long)fileSize(&order[i]->inode));
+                printDigest(out, order[i]->sha);
+                fprintf(out, "\n");
+                for (size_t k = i; k < j; k++) fprintf(out, "  %s\n", order[k]->path);
+            }
+            i = j;
+        }
+        free(order);
+    }
+
+    // Report the extra names of hard-linked files as links, not as duplicate content
+    for (size_t i = 0; i < job.count; ) {
+        size_t j = i + 1;
+        while (j < job.count && byInode[j]->iNum == byInode[i]->iNum) j++;
+        if (j - i > 1) {
+            fprintf(out, "\nHard links (inode %u, %zu names, %llu bytes):\n", byInode[i]->iNum, j - i,
+                    (unsigned long long)fileSize(&byInode[i]->inode));
+            for (size_t k = i; k < j; k++) fprintf(out, "  %s\n", byInode[k]->path);
+        }
+        i = j;
+    }
+    free(byInode);
+    fflush(out);
+
+    for (size_t i = 0; i < job.count; i++) free(job.entries[i].path);
+    free(job.entries);
+    pthread_mutex_destroy(&job.lock);
+    return ok;
+}
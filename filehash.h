@@ -0,0 +1,13 @@
+#ifndef FILEHASH_H
+#define FILEHASH_H
+
+#include "ext2.h"
+#include <stdio.h>
+
+// Compute SHA-256 and CRC32C of every regular file straight from the image, sharding files across
+// numThreads workers (0 = one per core). Writes one line per file sorted by path, then the groups of
+// files whose contents are identical. Hard links are read once and listed as links, not as duplicates.
+// Returns false if any file could not be read.
+bool hashExt2Files(struct Ext2File *f, int numThreads, FILE *out);
+
+#endif
@@ -0,0 +1,369 @@
+#include "freespace.h"
+#include "walk.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define FREESPACE_X86 1
+#endif
+
+#define FREESPACE_RUN_SIZE (1 << 20)  // Largest single read when loading bitmaps
+#define FREESPACE_READERS 16          // Bitmap reads kept in flight when no thread count is given
+#define FREESPACE_TOP_FILES 10        // How many of the most fragmented files to list
+
+typedef struct {
+    uint32_t block;  // Where the group's bitmap lives
+    uint32_t group;
+} BitmapLocation;
+
+// A stretch of bitmap blocks that sit next to each other on disk: where[first .. first + count)
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} BitmapRun;
+
+typedef struct {
+    struct Ext2File *f;
+    const BitmapLocation *where;
+    const BitmapRun *runs;
+    uint32_t numRuns;
+    uint8_t *bitmaps;
+    atomic_uint nextRun;    // Next run to be claimed by a reader
+    atomic_bool failed;
+} BitmapJob;
+
+typedef struct {
+    char *path;
+    uint32_t blocks;
+    uint32_t extents;
+    double score;
+} FragmentedFile;
+
+typedef struct {
+    struct Ext2File *f;
+    pthread_mutex_t lock;
+    uint64_t files;
+    uint64_t fragmentedFiles;
+    uint64_t totalBlocks;
+    uint64_t totalExtents;
+    FragmentedFile top[FREESPACE_TOP_FILES];  // Sorted, highest score first
+    int topCount;
+    FILE *perFile;          // When set, every file's score is written here as it is measured
+    bool failed;
+} FragmentationJob;
+
+static uint32_t popcountTable(const uint64_t *words, size_t count) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t w = words[i];
+        w = w - ((w >> 1) & 0x5555555555555555ULL);
+        w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+        w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        total += (uint32_t)((w * 0x0101010101010101ULL) >> 56);
+    }
+    return total;
+}
+
+#ifdef FREESPACE_X86
+__attribute__((target("popcnt")))
+static uint32_t popcountHardware(const uint64_t *words, size_t count) {
+    uint64_t a = 0, b = 0, c = 0, d = 0;  // Independent sums keep several popcnt units busy
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        a += __builtin_popcountll(words[i]);
+        b += __builtin_popcountll(words[i + 1]);
+        c += __builtin_popcountll(words[i + 2]);
+        d += __builtin_popcountll(words[i + 3]);
+    }
+    for (; i < count; i++) a += __builtin_popcountll(words[i]);
+    return (uint32_t)(a + b + c + d);
+}
+#endif
+
+// Count the set bits in a bitmap, using the popcnt instruction when the CPU has it
+static uint32_t countSetBits(const uint64_t *words, size_t count) {
+#ifdef FREESPACE_X86
+    static int havePopcnt = -1;
+    if (havePopcnt < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        havePopcnt = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_POPCNT);
+    }
+    if (havePopcnt) return popcountHardware(words, count);
+#endif
+    return popcountTable(words, count);
+}
+
+// Position of the first bit at or after pos that is set (used) or clear (free); nbits if there is none
+static uint32_t findNextBit(const uint64_t *words, uint32_t nbits, uint32_t pos, bool used) {
+    while (pos < nbits) {
+        uint64_t w = words[pos / 64];
+        if (!used) w = ~w;
+        w &= ~0ULL << (pos % 64);
+        if (w) {
+            uint32_t found = (pos & ~63u) + __builtin_ctzll(w);
+            return (found < nbits) ? found : nbits;
+        }
+        pos = (pos & ~63u) + 64;  // Whole word skipped in one step
+    }
+    return nbits;
+}
+
+static void addRun(FreeSpaceStats *stats, uint32_t length) {
+    if (length == 0) return;
+    stats->runs++;
+    if (length > stats->largestRun) stats->largestRun = length;
+    stats->histogram[31 - __builtin_clz(length)]++;
+}
+
+static int compareLocation(const void *a, const void *b) {
+    uint32_t x = ((const BitmapLocation *)a)->block, y = ((const BitmapLocation *)b)->block;
+    return (x > y) - (x < y);
+}
+
+static void *bitmapReader(void *arg) {
+    BitmapJob *job = (BitmapJob *)arg;
+    struct Ext2File *f = job->f;
+    uint8_t *run = malloc(FREESPACE_RUN_SIZE);
+    if (!run) return NULL;  // Runs this reader would have taken are picked up by the others
+
+    while (!atomic_load(&job->failed)) {
+        uint32_t r = atomic_fetch_add(&job->nextRun, 1);
+        if (r >= job->numRuns) break;
+        const BitmapLocation *where = job->where + job->runs[r].first;
+        uint32_t len = job->runs[r].count;
+
+        size_t bytes = (size_t)len * f->blockSize;
+        if (vdiReadPartitionAt(f->partition, run, bytes, (off_t)where[0].block * f->blockSize) != (ssize_t)bytes) {
+            fprintf(stderr, "Failed to read block bitmaps at block %u\n", where[0].block);
+            atomic_store(&job->failed, true);
+            break;
+        }
+        for (uint32_t k = 0; k < len; k++) {
+            memcpy(job->bitmaps + (size_t)where[k].group * f->blockSize, run + (size_t)k * f->blockSize, f->blockSize);
+        }
+    }
+    free(run);
+    return NULL;
+}
+
+// Bitmap blocks are sorted by disk position and adjacent ones merged into one read (flex_bg packs them
+// together). Plain ext2 keeps each bitmap inside its own group, so the runs are read by a pool of
+// threads with up to numThreads requests in flight instead of one group after another.
+uint8_t *fetchBlockBitmaps(struct Ext2File *f, int numThreads) {
+    uint32_t numGroups = f->numBlockGroups;
+    uint8_t *bitmaps = malloc((size_t)numGroups * f->blockSize);
+    BitmapLocation *where = malloc(numGroups * sizeof(BitmapLocation));
+    BitmapRun *runs = malloc(numGroups * sizeof(BitmapRun));
+    if (!bitmaps || !where || !runs) {
+        fprintf(stderr, "Failed to allocate bitmap buffers\n");
+        free(bitmaps);
+        free(where);
+        free(runs);
+        return NULL;
+    }
+
+    for (uint32_t g = 0; g < numGroups; g++) {
+        where[g].block = f->bgdt[g].bg_block_bitmap;
+        where[g].group = g;
+    }
+    qsort(where, numGroups, sizeof(BitmapLocation), compareLocation);
+
+    uint32_t numRuns = 0, maxRun = FREESPACE_RUN_SIZE / f->blockSize;
+    for (uint32_t i = 0; i < numGroups; ) {
+        uint32_t len = 1;
+        while (i + len < numGroups && where[i + len].block == where[i].block + len && len < maxRun) len++;
+        runs[numRuns++] = (BitmapRun){ i, len };
+        i += len;
+    }
+
+    if (numThreads <= 0) numThreads = FREESPACE_READERS;  // The reads wait on I/O, not on a core
+    if ((uint32_t)numThreads > numRuns) numThreads = numRuns;
+
+    BitmapJob job = { .f = f, .where = where, .runs = runs, .numRuns = numRuns, .bitmaps = bitmaps };
+    atomic_init(&job.nextRun, 0);
+    atomic_init(&job.failed, false);
+
+    pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; threads && i < numThreads; i++) {
+        if (pthread_create(&threads[i], NULL, bitmapReader, &job) != 0) break;
+        started++;
+    }
+    if (started == 0) bitmapReader(&job);  // No threads available, read on this one
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (atomic_load(&job.failed) || atomic_load(&job.nextRun) < numRuns) {  // A read failed or no reader got a buffer
+        free(bitmaps);
+        bitmaps = NULL;
+    }
+    free(where);
+    free(runs);
+    return bitmaps;
+}
+
+// Extents beyond the first, relative to how many there could be: 0 is contiguous, 1 is every block apart
+static double fragmentationScore(uint32_t extents, uint32_t blocks) {
+    return (blocks > 1) ? (double)(extents - 1) / (blocks - 1) : 0.0;
+}
+
+// Does a rank ahead of b? Higher score first, then more extents
+static bool ranksAhead(const FragmentedFile *a, double score, uint32_t extents) {
+    return a->score > score || (a->score == score && a->extents >= extents);
+}
+
+// Walk visitor: count the extents of every regular file
+static void measureFile(void *arg, const char *path, uint32_t iNum, Ext2Inode *inode) {
+    FragmentationJob *job = (FragmentationJob *)arg;
+    (void)iNum;  // Files are reported by path
+    if ((inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFREG) return;
+
+    uint32_t count;
+    uint32_t *blocks = fetchBlockList(job->f, inode, &count);
+    if (!blocks) {
+        pthread_mutex_lock(&job->lock);
+        job->failed = true;
+        pthread_mutex_unlock(&job->lock);
+        return;
+    }
+
+    uint32_t used = 0, extents = 0, prev = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (blocks[i] == 0) {
+            prev = 0;  // A hole ends the current extent
+            continue;
+        }
+        if (prev == 0 || blocks[i] != prev + 1) extents++;
+        prev = blocks[i];
+        used++;
+    }
+    free(blocks);
+    double score = fragmentationScore(extents, used);
+
+    pthread_mutex_lock(&job->lock);
+    job->files++;
+    job->totalBlocks += used;
+    job->totalExtents += extents;
+    if (job->perFile) fprintf(job->perFile, "    %.3f %8u %8u  %s\n", score, extents, used, path);
+    if (extents > 1) {
+        job->fragmentedFiles++;
+        int pos = job->topCount;
+        while (pos > 0 && !ranksAhead(&job->top[pos - 1], score, extents)) pos--;
+        if (pos < FREESPACE_TOP_FILES) {
+            char *copy = strdup(path);
+            if (copy) {
+                if (job->topCount == FREESPACE_TOP_FILES) free(job->top[FREESPACE_TOP_FILES - 1].path);
+                else job->topCount++;
+                memmove(&job->top[pos + 1], &job->top[pos], (job->topCount - 1 - pos) * sizeof(FragmentedFile));
+                job->top[pos] = (FragmentedFile){ copy, used, extents, score };
+            }
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void printHistogram(FILE *out, FreeSpaceStats *stats) {
+    for (int b = 0; b < FREESPACE_BUCKETS; b++) {
+        if (stats->histogram[b] == 0) continue;
+        fprintf(out, " %u-%u:%u", 1u << b, (uint32_t)((2ULL << b) - 1), stats->histogram[b]);
+    }
+}
+
+bool analyzeFreeSpace(struct Ext2File *f, int numThreads, bool perFile, FILE *out) {
+    Ext2Superblock *sb = &f->superblock;
+    uint8_t *bitmaps = fetchBlockBitmaps(f, numThreads);
+    if (!bitmaps) return false;
+
+    bool ok = true;
+    FreeSpaceStats total = { 0 };
+    uint32_t openRun = 0;  // Free run still open at the end of the previous group
+
+    fprintf(out, "Free space by block group:\n");
+    fprintf(out, "  Group       Free   Reported     Runs    Largest  Histogram (run length:count)\n");
+    for (uint32_t g = 0; g < f->numBlockGroups; g++) {
+        const uint64_t *words = (const uint64_t *)(bitmaps + (size_t)g * f->blockSize);
+        uint32_t firstBlock = sb->s_first_data_block + g * sb->s_blocks_per_group;
+        uint32_t nbits = sb->s_blocks_count - firstBlock;
+        if (nbits > sb->s_blocks_per_group) nbits = sb->s_blocks_per_group;
+
+        FreeSpaceStats group = { 0 };
+        uint32_t used = countSetBits(words, nbits / 64);
+        if (nbits % 64) {
+            uint64_t tail = words[nbits / 64] & ((1ULL << (nbits % 64)) - 1);  // Ignore padding past the last block
+            used += countSetBits(&tail, 1);
+        }
+        group.freeBlocks = nbits - used;
+        group.reportedFree = f->bgdt[g].bg_free_blocks_count;
+
+        uint32_t pos = findNextBit(words, nbits, 0, false);
+        if (pos != 0) {
+            addRun(&total, openRun);  // Group starts with a used block, so nothing carries over
+            openRun = 0;
+        }
+        while (pos < nbits) {
+            uint32_t end = findNextBit(words, nbits, pos, true);
+            addRun(&group, end - pos);
+
+            // Runs that touch a group boundary continue in the whole-file-system figures
+            if (pos == 0 && openRun > 0) {
+                openRun += end - pos;
+            } else {
+                addRun(&total, openRun);
+                openRun = end - pos;
+            }
+            if (end < nbits) {
+                addRun(&total, openRun);
+                openRun = 0;
+            }
+            pos = findNextBit(words, nbits, end, false);
+        }
+        total.freeBlocks += group.freeBlocks;
+
+        fprintf(out, "  %5u %10u %10u %8u %10u ", g, group.freeBlocks, group.reportedFree, group.runs, group.largestRun);
+        printHistogram(out, &group);
+        if (group.freeBlocks != group.reportedFree) fprintf(out, "  MISMATCH");
+        fprintf(out, "\n");
+    }
+    addRun(&total, openRun);
+    total.reportedFree = sb->s_free_blocks_count;
+    free(bitmaps);
+
+    fprintf(out, "\nWhole file system:\n");
+    fprintf(out, "  Free blocks (bitmaps): %u\n", total.freeBlocks);
+    fprintf(out, "  Free blocks (superblock): %u%s\n", total.reportedFree,
+            (total.freeBlocks != total.reportedFree) ? "  MISMATCH" : "");
+    fprintf(out, "  Free runs: %u\n", total.runs);
+    fprintf(out, "  Largest free run: %u blocks (%llu bytes)\n", total.largestRun,
+            (unsigned long long)total.largestRun * f->blockSize);
+    fprintf(out, "  Free run histogram:\n");
+    for (int b = 0; b < FREESPACE_BUCKETS; b++) {
+        if (total.histogram[b] == 0) continue;
+        fprintf(out, "    %10u-%-10u blocks: %u\n", 1u << b, (uint32_t)((2ULL << b) - 1), total.histogram[b]);
+    }
+
+    // Per-file fragmentation, streamed in walk order when every file was asked for
+    FragmentationJob job = { .f = f, .perFile = perFile ? out : NULL };
+    pthread_mutex_init(&job.lock, NULL);
+    if (perFile) fprintf(out, "\nFragmentation of every file (score, extents, blocks, path):\n");
+    if (!walkExt2Visit(f, numThreads, measureFile, &job) || job.failed) ok = false;
+
+    fprintf(out, "\nFile fragmentation:\n");
+    fprintf(out, "  Regular files: %llu\n", (unsigned long long)job.files);
+    fprintf(out, "  Fragmented files: %llu (%.1f%%)\n", (unsigned long long)job.fragmentedFiles,
+            job.files ? 100.0 * job.fragmentedFiles / job.files : 0.0);
+    fprintf(out, "  Average extents per file: %.2f\n", job.files ? (double)job.totalExtents / job.files : 0.0);
+    if (job.topCount > 0) {
+        fprintf(out, "  Most fragmented by score (extents, blocks, score, path):\n");
+        for (int i = 0; i < job.topCount; i++) {
+            FragmentedFile *ff = &job.top[i];
+            fprintf(out, "    %8u %8u  %.3f  %s\n", ff->extents, ff->blocks, ff->score, ff->path);
+            free(ff->path);
+        }
+    }
+    fflush(out);
+    pthread_mutex_destroy(&job.lock);
+    return ok;
+}
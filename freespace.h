@@ -0,0 +1,28 @@
+#ifndef FREESPACE_H
+#define FREESPACE_H
+
+#include "ext2.h"
+#include <stdio.h>
+
+#define FREESPACE_BUCKETS 32  // Histogram bucket i counts free runs of 2^i .. 2^(i+1)-1 blocks
+
+// Free-space figures for one block group, or for the whole file system
+typedef struct {
+    uint32_t freeBlocks;      // Counted from the bitmap
+    uint32_t reportedFree;    // bg_free_blocks_count / s_free_blocks_count
+    uint32_t largestRun;      // Longest run of free blocks
+    uint32_t runs;            // Number of free runs
+    uint32_t histogram[FREESPACE_BUCKETS];
+} FreeSpaceStats;
+
+// Load every group's block bitmap into one array, group g at g * blockSize, with up to numThreads
+// reads in flight (0 = a fixed queue depth). Caller frees it.
+uint8_t *fetchBlockBitmaps(struct Ext2File *f, int numThreads);
+
+// Read every block bitmap, report free-run histograms per group and for the file system,
+// cross-check them against the descriptor counts and score how fragmented each file is.
+// numThreads workers (0 = one per core) examine the files; the most fragmented are listed by score, and
+// with perFile every file's score is streamed as well. Returns false if anything could not be read.
+bool analyzeFreeSpace(struct Ext2File *f, int numThreads, bool perFile, FILE *out);
+
+#endif
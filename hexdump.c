@@ -0,0 +1,273 @@
+#include "hexdump.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEXDUMP_READ_SIZE (1 << 20)  // Bytes read from the image per request
+#define HEXDUMP_LINE_MAX 96          // Longest formatted line, with room to spare
+#define HEXDUMP_PAGE_MAX 2048        // Longest formatted displayBufferPage() page
+
+#define HEX_ROW(hi) hi "0" hi "1" hi "2" hi "3" hi "4" hi "5" hi "6" hi "7" \
+                    hi "8" hi "9" hi "a" hi "b" hi "c" hi "d" hi "e" hi "f"
+static const char hexPairs[] = HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+                               HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+                               HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b")
+                               HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");  // "00".."ff"
+
+static const char pageHeader[] =
+    "  00 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f 0...4...8...c...\n"
+    "  +------------------------------------------------+   +----------------+\n";
+static const char pageFooter[] =
+    "  +------------------------------------------------+   +----------------+\n\n";
+
+static inline char *putByte(char *p, uint8_t b) {
+    p[0] = hexPairs[b * 2];
+    p[1] = hexPairs[b * 2 + 1];
+    return p + 2;
+}
+
+static inline char printable(uint8_t b) {
+    return (b >= 0x20 && b < 0x7f) ? (char)b : '.';  // isprint() in the C locale
+}
+
+// Lower-case hex with at least minDigits digits, like %0Nlx
+static char *putHex(char *p, uint64_t value, int minDigits) {
+    int digits = 1;
+    while (digits < 16 && (value >> (digits * 4)) != 0) digits++;
+    if (digits < minDigits) digits = minDigits;
+    for (int i = digits - 1; i >= 0; i--) {
+        p[i] = hexPairs[(value & 0xf) * 2 + 1];
+        value >>= 4;
+    }
+    return p + digits;
+}
+
+static char *putString(char *p, const char *s, size_t length) {
+    memcpy(p, s, length);
+    return p + length;
+}
+
+// write() until everything is out; stdout's own buffer goes first so the output stays in order
+static bool writeAll(int fd, const char *text, size_t length) {
+    if (fd == STDOUT_FILENO) fflush(stdout);
+    while (length > 0) {
+        ssize_t n = write(fd, text, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("Failed to write hexdump");
+            return false;
+        }
+        text += n;
+        length -= n;
+    }
+    return true;
+}
+
+// One displayBufferPage() page: 16 rows of 16 bytes, only positions in [skip, skip + count) shown
+static size_t formatPage(char *out, const uint8_t *buf, uint32_t count, uint32_t skip, uint64_t offset) {
+    char *p = out;
+    p = putString(p, "Offset: 0x", 10);
+    p = putHex(p, offset, 1);
+    *p++ = '\n';
+    p = putString(p, pageHeader, sizeof(pageHeader) - 1);
+
+    for (uint32_t i = 0; i < 16; i++) {
+        uint32_t rowOffset = (uint32_t)(offset + i * 16);
+        p = putHex(p, rowOffset, 2);
+        *p++ = '|';
+        for (uint32_t j = 0; j < 16; j++) {
+            size_t pos = i * 16 + j;
+            if (pos >= skip && pos < skip + count) {
+                p = putByte(p, buf[pos]);
+            } else {
+                p[0] = ' ';
+                p[1] = ' ';
+                p += 2;
+            }
+            *p++ = ' ';
+        }
+        *p++ = '|';
+        p = putHex(p, rowOffset, 2);
+        *p++ = '|';
+        for (uint32_t j = 0; j < 16; j++) {
+            size_t pos = i * 16 + j;
+            *p++ = (pos >= skip && pos < skip + count) ? printable(buf[pos]) : ' ';
+        }
+        *p++ = '|';
+        *p++ = '\n';
+    }
+
+    p = putString(p, pageFooter, sizeof(pageFooter) - 1);
+    return p - out;
+}
+
+// Function to display a "page" (up to 256 bytes) of buffer content nicely formatted
+void displayBufferPage(uint8_t *buf, uint32_t count, uint32_t skip, uint64_t offset) {
+    char out[HEXDUMP_PAGE_MAX];
+    count = (count > 256) ? 256 : count;  // Ensure no more than 256 bytes are shown
+    writeAll(STDOUT_FILENO, out, formatPage(out, buf, count, skip, offset));
+}
+
+// Function to display an entire buffer in 256-byte chunks, formatted in bulk and written in large pieces
+void displayBuffer(uint8_t *buf, uint32_t count, uint64_t offset) {
+    char *out = malloc(HEXDUMP_OUTPUT_SIZE);
+    if (!out) return;
+    size_t used = 0;
+    for (uint32_t i = 0; i < count; i += 256) {
+        if (used + HEXDUMP_PAGE_MAX > HEXDUMP_OUTPUT_SIZE) {
+            if (!writeAll(STDOUT_FILENO, out, used)) break;
+            used = 0;
+        }
+        uint32_t chunk_size = (count - i > 256) ? 256 : count - i; // Calculate actual chunk size
+        used += formatPage(out + used, buf + i, chunk_size, 0, offset + i);
+    }
+    if (used > 0) writeAll(STDOUT_FILENO, out, used);
+    free(out);
+}
+
+static void flushOutput(HexDumper *h) {
+    if (!h->failed && !writeAll(h->fd, h->out, h->used)) h->failed = true;
+    h->used = 0;
+}
+
+// Format one line of up to 16 bytes, or a "*" if it repeats the line before it
+static void emitLine(HexDumper *h, const uint8_t *bytes, size_t length) {
+    if (h->used + HEXDUMP_LINE_MAX > HEXDUMP_OUTPUT_SIZE) flushOutput(h);
+    char *p = h->out + h->used;
+
+    if (length == 16 && h->havePrevious && memcmp(bytes, h->previous, 16) == 0) {
+        if (!h->collapsing) {
+            *p++ = '*';
+            *p++ = '\n';
+            h->collapsing = true;
+        }
+        h->used = p - h->out;
+        h->offset += 16;
+        return;
+    }
+
+    p = putHex(p, h->offset, 8);
+    *p++ = ' ';
+    *p++ = ' ';
+    for (size_t i = 0; i < 16; i++) {
+        if (i < length) {
+            p = putByte(p, bytes[i]);
+        } else {
+            p[0] = ' ';
+            p[1] = ' ';
+            p += 2;
+        }
+        *p++ = ' ';
+        if (i == 7) *p++ = ' ';
+    }
+    *p++ = ' ';
+    *p++ = '|';
+    for (size_t i = 0; i < length; i++) *p++ = printable(bytes[i]);
+    *p++ = '|';
+    *p++ = '\n';
+    h->used = p - h->out;
+
+    h->collapsing = false;
+    h->havePrevious = (length == 16);
+    if (h->havePrevious) memcpy(h->previous, bytes, 16);
+    h->offset += length;
+}
+
+bool hexDumperInit(HexDumper *h, int fd, uint64_t offset) {
+    memset(h, 0, sizeof(*h));
+    h->fd = fd;
+    h->offset = offset;
+    h->out = malloc(HEXDUMP_OUTPUT_SIZE);
+    return h->out != NULL;
+}
+
+bool hexDumperFeed(HexDumper *h, const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    // Complete a line left over from the previous call
+    if (h->lineLength > 0) {
+        size_t take = 16 - h->lineLength;
+        if (take > length) take = length;
+        memcpy(h->line + h->lineLength, bytes, take);
+        h->lineLength += take;
+        bytes += take;
+        length -= take;
+        if (h->lineLength < 16) return !h->failed;
+        emitLine(h, h->line, 16);
+        h->lineLength = 0;
+    }
+
+    for (; length >= 16; bytes += 16, length -= 16) emitLine(h, bytes, 16);
+
+    memcpy(h->line, bytes, length);
+    h->lineLength = length;
+    return !h->failed;
+}
+
+bool hexDumperFinish(HexDumper *h) {
+    if (h->lineLength > 0) emitLine(h, h->line, h->lineLength);
+    h->lineLength = 0;
+
+    if (h->used + HEXDUMP_LINE_MAX > HEXDUMP_OUTPUT_SIZE) flushOutput(h);
+    char *p = h->out + h->used;
+    p = putHex(p, h->offset, 8);
+    *p++ = '\n';
+    h->used = p - h->out;
+    flushOutput(h);
+
+    free(h->out);
+    h->out = NULL;
+    return !h->failed;
+}
+
+bool parseHexdumpSpace(const char *name, HexdumpSpace *space) {
+    if (strcmp(name, "disk") == 0) {
+        *space = HEXDUMP_DISK;
+    } else if (strcmp(name, "part") == 0 || strcmp(name, "partition") == 0) {
+        *space = HEXDUMP_PARTITION;
+    } else if (strcmp(name, "block") == 0 || strcmp(name, "blocks") == 0) {
+        *space = HEXDUMP_BLOCKS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool hexdumpRange(struct Ext2File *f, HexdumpSpace space, uint64_t start, uint64_t length, int fd) {
+    if (space == HEXDUMP_BLOCKS) {  // Blocks are partition bytes in block-sized units
+        if (start > UINT64_MAX / f->blockSize || length > UINT64_MAX / f->blockSize) {
+            printf("Block range is out of range\n");
+            return false;
+        }
+        start *= f->blockSize;
+        length *= f->blockSize;
+    }
+    if (start > INT64_MAX || length > INT64_MAX - start) {  // Every offset in the range must fit in an off_t
+        printf("Range 0x%llx + 0x%llx is out of range\n", (unsigned long long)start, (unsigned long long)length);
+        return false;
+    }
+
+    HexDumper h;
+    uint8_t *buf = malloc(HEXDUMP_READ_SIZE);
+    if (!buf || !hexDumperInit(&h, fd, start)) {
+        free(buf);
+        return false;
+    }
+
+    uint64_t done = 0;
+    while (done < length) {
+        size_t want = (length - done < HEXDUMP_READ_SIZE) ? length - done : HEXDUMP_READ_SIZE;
+        off_t offset = (off_t)(start + done);
+        ssize_t got = (space == HEXDUMP_DISK) ? vdiReadAt(f->partition->vdi, buf, want, offset)
+                                              : vdiReadPartitionAt(f->partition, buf, want, offset);
+        if (got <= 0) break;
+        done += got;
+        if (!hexDumperFeed(&h, buf, got) || (size_t)got < want) break;
+    }
+
+    bool ok = hexDumperFinish(&h);
+    free(buf);
+    if (done < length) printf("Read %llu of %llu bytes\n", (unsigned long long)done, (unsigned long long)length);
+    return ok && done == length;
+}
@@ -0,0 +1,39 @@
+#ifndef HEXDUMP_H
+#define HEXDUMP_H
+
+#include "ext2.h"
+
+#define HEXDUMP_OUTPUT_SIZE (256 << 10)  // Formatted text collected before each write()
+
+// Streaming "offset  hex  |ascii|" formatter, 16 bytes per line. A run of lines identical to the
+// one before it is printed as a single "*" line, and the end offset is printed last.
+typedef struct {
+    int fd;                 // Where the text is written
+    char *out;              // Formatted text waiting to be written
+    size_t used;
+    uint64_t offset;        // Offset of the next line
+    uint8_t line[16];       // Bytes of a line split across hexDumperFeed() calls
+    size_t lineLength;
+    uint8_t previous[16];   // Last full line, for collapsing repeats
+    bool havePrevious;
+    bool collapsing;        // A "*" has been printed for the current run
+    bool failed;            // A write() failed
+} HexDumper;
+
+// Address space a range dump reads from
+typedef enum {
+    HEXDUMP_DISK,       // Logical VDI disk bytes
+    HEXDUMP_PARTITION,  // Bytes from the start of the ext2 partition
+    HEXDUMP_BLOCKS      // File system blocks (start and length count blocks)
+} HexdumpSpace;
+
+bool hexDumperInit(HexDumper *h, int fd, uint64_t offset);         // offset = address of the first byte fed
+bool hexDumperFeed(HexDumper *h, const void *data, size_t length);  // Format more bytes (any length)
+bool hexDumperFinish(HexDumper *h);                                 // Write what is left and free the buffer
+
+// Dump length bytes (or blocks) starting at start, reading 1 MiB at a time straight from the image.
+// Returns false if the range could not be read completely or the output could not be written.
+bool hexdumpRange(struct Ext2File *f, HexdumpSpace space, uint64_t start, uint64_t length, int fd);
+bool parseHexdumpSpace(const char *name, HexdumpSpace *space);      // "disk", "part" or "block"
+
+#endif
@@ -0,0 +1,202 @@
+#include "inodescan.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INODESCAN_READ_SIZE (1 << 20)  // Bytes of inode table read per request
+#define INODESCAN_MAX_ORPHANS 20       // Orphans listed by reportInodes()
+
+typedef struct {
+    struct Ext2File *f;
+    InodeScanCallback callback;
+    void *arg;
+    atomic_uint nextGroup;  // Next group to be claimed by a worker
+    atomic_bool stop;       // Set on a read error or when the callback asks to stop
+} ScanJob;
+
+// Does the bitmap have any bit set in [from, to)?
+static bool anyBitSet(const uint8_t *bitmap, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        if ((i % 8) == 0 && i + 8 <= to && bitmap[i / 8] == 0) {
+            i += 7;  // Skip a whole empty byte
+            continue;
+        }
+        if (bitmap[i / 8] & (1 << (i % 8))) return true;
+    }
+    return false;
+}
+
+static bool scanGroup(ScanJob *job, uint32_t group, uint8_t *bitmap, uint8_t *table, uint32_t *iNums, Ext2Inode *inodes) {
+    struct Ext2File *f = job->f;
+    uint32_t perGroup = f->superblock.s_inodes_per_group;
+
+    if (!fetchBlock(f, f->bgdt[group].bg_inode_bitmap, bitmap)) return false;
+
+    // Nothing past the last used inode needs to be read
+    uint32_t last = perGroup;
+    while (last > 0 && !(bitmap[(last - 1) / 8] & (1 << ((last - 1) % 8)))) last--;
+
+    uint32_t perRead = INODESCAN_READ_SIZE / f->inodeSize;
+    off_t tableOffset = (off_t)f->bgdt[group].bg_inode_table * f->blockSize;
+    for (uint32_t first = 0; first < last && !atomic_load(&job->stop); first += perRead) {
+        uint32_t end = (first + perRead < last) ? first + perRead : last;
+        if (!anyBitSet(bitmap, first, end)) continue;  // Whole stretch unused
+
+        size_t bytes = (size_t)(end - first) * f->inodeSize;
+        if (vdiReadPartitionAt(f->partition, table, bytes, tableOffset + (off_t)first * f->inodeSize) != (ssize_t)bytes) {
+            fprintf(stderr, "Failed to read inode table of group %u\n", group);
+            return false;
+        }
+
+        uint32_t count = 0;
+        for (uint32_t i = first; i < end; i++) {
+            if (!(bitmap[i / 8] & (1 << (i % 8)))) continue;
+            iNums[count] = group * perGroup + i + 1;  // Inode numbers start at 1
+            memcpy(&inodes[count], table + (size_t)(i - first) * f->inodeSize, sizeof(Ext2Inode));
+            count++;
+        }
+        if (count > 0 && !job->callback(job->arg, group, count, iNums, inodes)) {
+            atomic_store(&job->stop, true);
+        }
+    }
+    return true;
+}
+
+static void *scanWorker(void *arg) {
+    ScanJob *job = (ScanJob *)arg;
+    struct Ext2File *f = job->f;
+    uint32_t perRead = INODESCAN_READ_SIZE / f->inodeSize;
+
+    uint8_t *bitmap = bufferPoolGet(&f->blockPool);
+    uint8_t *table = malloc(INODESCAN_READ_SIZE);
+    uint32_t *iNums = malloc(perRead * sizeof(uint32_t));
+    Ext2Inode *inodes = malloc(perRead * sizeof(Ext2Inode));
+    if (!bitmap || !table || !iNums || !inodes) atomic_store(&job->stop, true);
+
+    while (!atomic_load(&job->stop)) {
+        uint32_t group = atomic_fetch_add(&job->nextGroup, 1);
+        if (group >= f->numBlockGroups) break;
+        if (!scanGroup(job, group, bitmap, table, iNums, inodes)) atomic_store(&job->stop, true);
+    }
+
+    bufferPoolPut(&f->blockPool, bitmap);
+    free(table);
+    free(iNums);
+    free(inodes);
+    return NULL;
+}
+
+bool scanInodes(struct Ext2File *f, int numThreads, InodeScanCallback callback, void *arg) {
+    if (numThreads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = (cores > 0) ? (int)cores : 1;
+    }
+    if ((uint32_t)numThreads > f->numBlockGroups) numThreads = f->numBlockGroups;  // A group is the unit of work
+
+    ScanJob job = { .f = f, .callback = callback, .arg = arg };
+    atomic_init(&job.nextGroup, 0);
+    atomic_init(&job.stop, false);
+
+    pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; threads && i < numThreads; i++) {
+        if (pthread_create(&threads[i], NULL, scanWorker, &job) != 0) break;
+        started++;
+    }
+    if (started == 0) scanWorker(&job);  // No threads available, scan on this one
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    return !atomic_load(&job.stop);  // Set by read failures and by a callback that stopped early
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t firstIno;      // First non-reserved inode
+    uint32_t *usedPerGroup; // Each group is scanned by one worker, so no lock is needed for this
+    uint64_t inUse;
+    uint64_t reserved;      // Inodes below firstIno (root, resize, journal, ...), whatever their mode
+    uint64_t regular, directories, symlinks, other;
+    uint64_t totalSize;     // Bytes in regular files
+    uint64_t totalSectors;  // Sum of i_blocks (512-byte units)
+    uint32_t orphans[INODESCAN_MAX_ORPHANS];
+    uint64_t orphanCount;
+} InodeReport;
+
+static bool tallyInodes(void *arg, uint32_t group, uint32_t count, const uint32_t *iNums, const Ext2Inode *inodes) {
+    InodeReport *report = (InodeReport *)arg;
+    uint64_t reserved = 0, regular = 0, directories = 0, symlinks = 0, other = 0, size = 0, sectors = 0;
+
+    report->usedPerGroup[group] += count;
+    for (uint32_t i = 0; i < count; i++) {
+        sectors += inodes[i].i_blocks;
+        if (iNums[i] < report->firstIno) {
+            reserved++;  // Not user files: the resize inode, for one, is "regular" with an i_size spanning the reserve
+            continue;
+        }
+        switch (inodes[i].i_mode & EXT2_S_IFMT) {
+            case EXT2_S_IFREG: regular++; size += fileSize((Ext2Inode *)&inodes[i]); break;
+            case EXT2_S_IFDIR: directories++; break;
+            case EXT2_S_IFLNK: symlinks++; break;
+            default:           other++; break;
+        }
+    }
+
+    pthread_mutex_lock(&report->lock);
+    report->inUse += count;
+    report->reserved += reserved;
+    report->regular += regular;
+    report->directories += directories;
+    report->symlinks += symlinks;
+    report->other += other;
+    report->totalSize += size;
+    report->totalSectors += sectors;
+    for (uint32_t i = 0; i < count; i++) {
+        if (iNums[i] < report->firstIno || inodes[i].i_links_count != 0) continue;
+        if (report->orphanCount < INODESCAN_MAX_ORPHANS) report->orphans[report->orphanCount] = iNums[i];
+        report->orphanCount++;
+    }
+    pthread_mutex_unlock(&report->lock);
+    return true;
+}
+
+bool reportInodes(struct Ext2File *f, int numThreads, FILE *out) {
+    Ext2Superblock *sb = &f->superblock;
+    InodeReport report = { 0 };
+    report.firstIno = (sb->s_rev_level == 0) ? 11 : sb->s_first_ino;
+    report.usedPerGroup = calloc(f->numBlockGroups, sizeof(uint32_t));
+    if (!report.usedPerGroup) return false;
+    pthread_mutex_init(&report.lock, NULL);
+
+    bool ok = scanInodes(f, numThreads, tallyInodes, &report);
+
+    fprintf(out, "Inodes in use: %llu (superblock says %u)%s\n", (unsigned long long)report.inUse,
+            sb->s_inodes_count - sb->s_free_inodes_count,
+            (report.inUse != sb->s_inodes_count - sb->s_free_inodes_count) ? "  MISMATCH" : "");
+    fprintf(out, "  Regular files: %llu\n", (unsigned long long)report.regular);
+    fprintf(out, "  Directories: %llu\n", (unsigned long long)report.directories);
+    fprintf(out, "  Symbolic links: %llu\n", (unsigned long long)report.symlinks);
+    fprintf(out, "  Reserved (below inode %u, including the root directory): %llu\n", report.firstIno, (unsigned long long)report.reserved);
+    fprintf(out, "  Other (devices, fifos, sockets): %llu\n", (unsigned long long)report.other);
+    fprintf(out, "Bytes in regular files: %llu\n", (unsigned long long)report.totalSize);
+    fprintf(out, "Blocks allocated to inodes: %llu\n", (unsigned long long)(report.totalSectors / (f->blockSize / 512)));
+
+    for (uint32_t g = 0; g < f->numBlockGroups; g++) {
+        uint32_t reported = sb->s_inodes_per_group - f->bgdt[g].bg_free_inodes_count;
+        if (report.usedPerGroup[g] != reported) {
+            fprintf(out, "Group %u: %u inodes in use, descriptor says %u  MISMATCH\n", g, report.usedPerGroup[g], reported);
+        }
+    }
+
+    fprintf(out, "Orphans (in use with no links): %llu\n", (unsigned long long)report.orphanCount);
+    for (uint64_t i = 0; i < report.orphanCount && i < INODESCAN_MAX_ORPHANS; i++) {
+        fprintf(out, "  inode %u\n", report.orphans[i]);
+    }
+    fflush(out);
+
+    free(report.usedPerGroup);
+    pthread_mutex_destroy(&report.lock);
+    return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef INODESCAN_H
+#define INODESCAN_H
+
+#include "ext2.h"
+#include <stdio.h>
+
+// Receives a batch of in-use inodes from one block group: iNums[i] is the number of inodes[i].
+// Groups are scanned in parallel, so the callback may run on several threads at once.
+// Return false to stop the scan early.
+typedef bool (*InodeScanCallback)(void *arg, uint32_t group, uint32_t count, const uint32_t *iNums, const Ext2Inode *inodes);
+
+// Visit every inode marked in use in the inode bitmaps. Each group's inode table is read in large
+// sequential chunks rather than one inode at a time; numThreads workers (0 = one per core) take
+// whole groups. Returns false if a read failed or the callback stopped the scan.
+bool scanInodes(struct Ext2File *f, int numThreads, InodeScanCallback callback, void *arg);
+
+// Print an audit of all in-use inodes: counts by type, size and block totals, and inodes that are
+// marked in use but have no links (orphans), cross-checked against the superblock counts.
+bool reportInodes(struct Ext2File *f, int numThreads, FILE *out);
+
+#endif
@@ -1,95 +1,149 @@
 // Include necessary header files
 #include "ext2.h"     // Custom header for ext2 file system operations
+#include "walk.h"     // Parallel tree walker / manifest writer
+#include "filehash.h" // Per-file SHA-256 / CRC32C checksums
+#include "freespace.h" // Free-space and fragmentation report
+#include "command.h"  // Command-stream mode
+#include "inodescan.h" // Bulk inode-table scan
+#include "trim.h"     // Release frames that only hold free blocks
+#include "hexdump.h"  // Buffered hexdump of disk, partition or block ranges
 #include <stdio.h>    // Standard I/O functions
+#include <stdlib.h>   // atoi()
+#include <string.h>   // strcmp()
 #include <stdint.h>   // Standard integer types like uint8_t, uint32_t
-#include <ctype.h>    // Functions like isprint() to check printable characters
-
-// Function prototypes for displaying buffer contents
-void displayBufferPage(uint8_t *buf, uint32_t count, uint32_t skip, uint64_t offset);
-void displayBuffer(uint8_t *buf, uint32_t count, uint64_t offset);
+#include <unistd.h>   // STDOUT_FILENO
 
 // Main function: entry point of the program
-int main() {
-    // Open the ext2 filesystem stored in a VDI file
-    struct Ext2File *ext2 = openExt2("./good-dynamic-1k.vdi");
+// Usage: prog [--direct] [--snapshot | --overlay FILE] [image.vdi] [manifest [csv|jsonl] [threads] | hash [threads] | freespace [threads] [files] | shell [script] | inodes [threads] | trim [compact] | dump disk|part|block START LENGTH]
+int main(int argc, char *argv[]) {
+    // --direct bypasses the page cache (O_DIRECT) for all image I/O
+    // --snapshot opens the image read-only and keeps writes in memory; --overlay FILE keeps them in a side file
+    int vdiFlags = 0;
+    char *overlay = NULL;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--direct") == 0) {
+            vdiFlags |= VDI_OPEN_DIRECT;
+        } else if (strcmp(argv[1], "--snapshot") == 0) {
+            vdiFlags |= VDI_OPEN_SNAPSHOT;
+        } else if (strcmp(argv[1], "--overlay") == 0 && argc > 2) {
+            overlay = argv[2];
+            argv++;
+            argc--;
+        } else {
+            printf("Unknown option: %s\n", argv[1]);
+            return 1;
+        }
+        argv++;
+        argc--;
+    }
+    char *image = (argc > 1) ? argv[1] : "./good-dynamic-1k.vdi";
+
+    // Open the VDI file, then the ext2 filesystem stored in it
+    VDIFile *vdi = overlay ? vdiOpenSnapshot(image, overlay, vdiFlags) : vdiOpenFlags(image, vdiFlags);
+    if (!vdi) {
+        return 1;
+    }
+    struct Ext2File *ext2 = openExt2OnImage(vdi, -1);
+    vdiClose(vdi);  // The filesystem keeps its own reference
     if (!ext2) {  // Check if opening failed
         return 1; // Return error code
     }
 
+    // Manifest mode: stream one record per file to stdout and exit
+    if (argc > 2 && strcmp(argv[2], "manifest") == 0) {
+        ManifestFormat format = (argc > 3 && strcmp(argv[3], "jsonl") == 0) ? MANIFEST_JSONL : MANIFEST_CSV;
+        int threads = (argc > 4) ? atoi(argv[4]) : 0;  // 0 = one worker per core
+        bool ok = walkExt2(ext2, threads, format, stdout);
+        closeExt2(ext2);
+        return ok ? 0 : 1;
+    }
+
+    // Hash mode: checksum every file and list duplicate contents
+    if (argc > 2 && strcmp(argv[2], "hash") == 0) {
+        int threads = (argc > 3) ? atoi(argv[3]) : 0;
+        bool ok = hashExt2Files(ext2, threads, stdout);
+        closeExt2(ext2);
+        return ok ? 0 : 1;
+    }
+
+    // Free-space mode: bitmap histograms, counter cross-check and file fragmentation
+    if (argc > 2 && strcmp(argv[2], "freespace") == 0) {
+        int threads = (argc > 3) ? atoi(argv[3]) : 0;
+        bool perFile = argc > 3 && strcmp(argv[argc - 1], "files") == 0;  // Also list the score of every file
+        bool ok = analyzeFreeSpace(ext2, threads, perFile, stdout);
+        closeExt2(ext2);
+        return ok ? 0 : 1;
+    }
+
+    // Inode mode: audit every in-use inode with a bulk inode-table scan
+    if (argc > 2 && strcmp(argv[2], "inodes") == 0) {
+        int threads = (argc > 3) ? atoi(argv[3]) : 0;
+        bool ok = reportInodes(ext2, threads, stdout);
+        closeExt2(ext2);
+        return ok ? 0 : 1;
+    }
+
+    // Trim mode: shrink the image by dropping frames that only cover free blocks
+    if (argc > 2 && strcmp(argv[2], "trim") == 0) {
+        bool compact = (argc > 3 && strcmp(argv[3], "compact") == 0);
+        bool ok = trimExt2(ext2, compact, stdout);
+        closeExt2(ext2);
+        return ok ? 0 : 1;
+    }
+
+    // Dump mode: hexdump a disk, partition or block range straight from the image
+    if (argc > 2 && strcmp(argv[2], "dump") == 0) {
+        HexdumpSpace space;
+        uint64_t start, length;
+        if (argc < 6 || !parseHexdumpSpace(argv[3], &space) || !parseNumber(argv[4], &start) ||
+            !parseNumber(argv[5], &length) || length == 0) {
+            printf("Usage: %s [image.vdi] dump disk|part|block START LENGTH (numbers decimal or 0x hex, LENGTH > 0)\n", argv[0]);
+            closeExt2(ext2);
+            return 1;
+        }
+        bool ok = hexdumpRange(ext2, space, start, length, STDOUT_FILENO);
+        closeExt2(ext2);
+        return ok ? 0 : 1;
+    }
+
+    // Shell mode: run commands from a script file (or stdin) against this one open image
+    if (argc > 2 && strcmp(argv[2], "shell") == 0) {
+        FILE *in = (argc > 3) ? fopen(argv[3], "r") : stdin;
+        if (!in) {
+            perror("Failed to open command script");
+            closeExt2(ext2);
+            return 1;
+        }
+        int failed = runCommands(ext2, in);
+        if (in != stdin) fclose(in);
+        closeExt2(ext2);
+        return failed ? 1 : 0;
+    }
+
     // Print the contents of the superblock
     printf("Superblock:\n");
     displaySuperblock(&ext2->superblock);
 
-    // Inform about the next operation
-    printf("\nReading first 1KB block from the file system:\n");
+    // Block numbers are absolute, so the superblock's block is s_first_data_block (block 0 is the boot block on 1KB file systems)
+    uint32_t superblockBlock = ext2->superblock.s_first_data_block;
+    uint32_t inBlock = (superblockBlock == 0) ? EXT2_SUPERBLOCK_OFFSET : 0;  // Larger blocks hold it 1KB in
+    printf("\nRaw bytes from block %u superblock:\n", superblockBlock);
 
-    // Prepare a 1KB buffer
-    uint8_t buffer[1024];
+    // Take a block-sized buffer from the pool (fetchBlock() reads a whole block, which may be 4KB or more)
+    uint8_t *buffer = bufferPoolGet(&ext2->blockPool);
 
-    // Read block 0 into buffer
-    if (fetchBlock(ext2, 0, buffer)) {
-        // If successful, display buffer content
-        displayBuffer(buffer, 1024, 0);
+    // Read the superblock's block into buffer
+    if (buffer && fetchBlock(ext2, superblockBlock, buffer)) {
+        // If successful, display the 1KB holding the superblock
+        displayBuffer(buffer + inBlock, 1024, inBlock);
     } else {
         // If failed, print error
         printf("Failed to read block.\n");
     }
+    bufferPoolPut(&ext2->blockPool, buffer);
 
     // Close the ext2 filesystem and clean up
     closeExt2(ext2);
 
     return 0; // Program ended successfully
 }
-
-// Function to display a "page" (up to 256 bytes) of buffer content nicely formatted
-void displayBufferPage(uint8_t *buf, uint32_t count, uint32_t skip, uint64_t offset) {
-    count = (count > 256) ? 256 : count;  // Ensure no more than 256 bytes are shown
-
-    // Print offset header
-    printf("Offset: 0x%lx\n", offset);
-    printf("  00 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f 0...4...8...c...\n");
-    printf("  +------------------------------------------------+   +----------------+\n");
-
-    // Loop over 16 rows (each with 16 bytes)
-    for (uint32_t i = 0; i < 16; i++) {
-        // Print row offset
-        printf("%02x|", (unsigned int)(offset + i * 16));
-
-        // Hexadecimal byte display
-        for (uint32_t j = 0; j < 16; j++) {
-            size_t pos = i * 16 + j; // Calculate buffer position
-            if (pos >= skip && pos < skip + count) {
-                printf("%02x ", buf[pos]); // Print byte as hex
-            } else {
-                printf("   "); // Print empty spaces for skipped bytes
-            }
-        }
-
-        // Print mirrored offset again
-        printf("|%02x|", (unsigned int)(offset + i * 16));
-
-        // ASCII character display
-        for (uint32_t j = 0; j < 16; j++) {
-            size_t pos = i * 16 + j;
-            if (pos >= skip && pos < skip + count) {
-                // If printable, print the character, else print '.'
-                printf("%c", isprint(buf[pos]) ? buf[pos] : '.');
-            } else {
-                printf(" "); // Empty space for skipped bytes
-            }
-        }
-        printf("|\n"); // End of the row
-    }
-
-    // Print footer
-    printf("  +------------------------------------------------+   +----------------+\n\n");
-}
-
-// Function to display an entire buffer in 256-byte chunks
-void displayBuffer(uint8_t *buf, uint32_t count, uint64_t offset) {
-    // Loop over the buffer in steps of 256 bytes
-    for (uint32_t i = 0; i < count; i += 256) {
-        uint32_t chunk_size = (count - i > 256) ? 256 : count - i; // Calculate actual chunk size
-        displayBufferPage(buf + i, chunk_size, 0, offset + i);     // Display each 256-byte chunk
-    }
-}
\ No newline at end of file
@@ -7,21 +7,35 @@
 
 // Open a specific partition from a VDI file
 MBRPartition* openPartition(const char *filename, int part) {
+    return openPartitionFlags(filename, part, 0);
+}
+
+// Open a specific partition, passing VDI_OPEN_* options down to the VDI layer
+MBRPartition* openPartitionFlags(const char *filename, int part, int vdiFlags) {
+    // Open the VDI file
+    VDIFile *vdi = vdiOpenFlags(filename, vdiFlags);
+    if (!vdi) return NULL;
+
+    MBRPartition *partition = openPartitionOnImage(vdi, part);
+    vdiClose(vdi);  // The partition holds its own reference
+    return partition;
+}
+
+// Open a view of one partition on a VDI file that is already open. The view only holds the
+// partition table and its bounds; fd, header and map stay shared with the other views.
+MBRPartition* openPartitionOnImage(VDIFile *vdi, int part) {
+    if (!vdi || part < 0 || part > 3) return NULL;
+
     // Allocate memory for the partition struct
     MBRPartition *partition = malloc(sizeof(MBRPartition));
     if (!partition) return NULL;
 
-    // Open the VDI file
-    partition->vdi = vdiOpen(filename);
-    if (!partition->vdi) {
+    // Read the 64-byte partition table (4 entries) at the MBR location (byte 446)
+    if (vdiReadAt(vdi, partition->partitionTable, 64, 446) != 64) {
         free(partition);
         return NULL;
     }
-
-    // Seek to the MBR partition table location (byte 446)
-    lseek(partition->vdi->fd, 446, SEEK_SET);
-    // Read the 64-byte partition table (4 entries)
-    read(partition->vdi->fd, partition->partitionTable, 64);
+    partition->vdi = vdiRetain(vdi);
 
     // Select the partition entry specified by 'part'
     uint8_t *entry = partition->partitionTable + part * 16;
@@ -37,61 +51,36 @@ MBRPartition* openPartition(const char *filename, int part) {
 // Close the partition and free resources
 void closePartition(MBRPartition *partition) {
     if (partition) {
-        vdiClose(partition->vdi); // Close underlying VDI file
+        vdiClose(partition->vdi); // Release the VDI file (closed with its last user)
         free(partition);          // Free the partition struct
     }
 }
 
 // Read from a partition
 ssize_t vdiReadPartition(MBRPartition *partition, void *buf, size_t count) {
-    size_t bytesRead = 0;
-    uint8_t *buffer = (uint8_t *)buf;
-
-    // Read in chunks (up to 512 bytes per loop)
-    while (count > 0) {
-        // Calculate logical offset within the VDI
-        off_t logicalOffset = partition->startSector * 512 + partition->cursor;
-        // Translate to physical offset using VDI's metadata
-        off_t physicalOffset = vdiTranslate(partition->vdi, logicalOffset);
-        if (physicalOffset == -1) return bytesRead; // Translation failed
-
-        // Read up to a sector (or remaining count)
-        size_t toRead = (count < 512) ? count : 512;
-        lseek(partition->vdi->fd, physicalOffset, SEEK_SET);
-        ssize_t result = read(partition->vdi->fd, buffer, toRead);
-        if (result <= 0) break; // EOF or error
-
-        // Update counters and pointers
-        bytesRead += result;
-        buffer += result;
-        count -= result;
-        partition->cursor += result;
-    }
-    return bytesRead;
+    ssize_t result = vdiReadPartitionAt(partition, buf, count, partition->cursor);
+    if (result > 0) partition->cursor += result;
+    return result;
+}
+
+// Read from a partition at a fixed offset; the cursor is left alone so several threads can share the partition
+ssize_t vdiReadPartitionAt(MBRPartition *partition, void *buf, size_t count, off_t offset) {
+    off_t partitionSize = (off_t)partition->sectorCount * 512;
+    if (offset < 0 || offset >= partitionSize) return 0;
+    if ((off_t)count > partitionSize - offset) count = partitionSize - offset; // Clamp to the partition
+
+    return vdiReadAt(partition->vdi, buf, count, (off_t)partition->startSector * 512 + offset);
 }
 
 // Write to a partition
 ssize_t writePartition(MBRPartition *partition, void *buf, size_t count) {
-    size_t bytesWritten = 0;
-    uint8_t *buffer = (uint8_t *)buf;
-
-    // Write in chunks (up to 512 bytes per loop)
-    while (count > 0) {
-        off_t logicalOffset = partition->startSector * 512 + partition->cursor;
-        off_t physicalOffset = vdiTranslate(partition->vdi, logicalOffset);
-        if (physicalOffset == -1) return bytesWritten;
-
-        size_t toWrite = (count < 512) ? count : 512;
-        lseek(partition->vdi->fd, physicalOffset, SEEK_SET);
-        ssize_t result = write(partition->vdi->fd, buffer, toWrite);
-        if (result <= 0) break;
-
-        bytesWritten += result;
-        buffer += result;
-        count -= result;
-        partition->cursor += result;
-    }
-    return bytesWritten;
+    off_t partitionSize = (off_t)partition->sectorCount * 512;
+    if ((off_t)partition->cursor >= partitionSize) return 0;
+    if ((off_t)count > partitionSize - (off_t)partition->cursor) count = partitionSize - partition->cursor; // Clamp to the partition
+
+    ssize_t result = vdiWriteAt(partition->vdi, buf, count, (off_t)partition->startSector * 512 + partition->cursor);
+    if (result > 0) partition->cursor += result;
+    return result;
 }
 
 // Seek within the partition
@@ -104,13 +93,13 @@ off_t vdiSeekPartition(MBRPartition *partition, off_t offset, int anchor) {
     } else if (anchor == SEEK_CUR) {
         newCursor = partition->cursor + offset;
     } else if (anchor == SEEK_END) {
-        newCursor = partition->sectorCount * 512 + offset;
+        newCursor = (off_t)partition->sectorCount * 512 + offset;
     } else {
         return -1; // Invalid anchor
     }
 
     // Bounds checking to ensure we don't seek outside the partition
-    if (newCursor < 0 || newCursor > (off_t)(partition->sectorCount * 512))
+    if (newCursor < 0 || newCursor > (off_t)partition->sectorCount * 512)
         return -1;
 
     partition->cursor = newCursor;
@@ -23,8 +23,11 @@ typedef struct {
 } MBRPartition;
 
 MBRPartition* openPartition(const char *filename, int part); // Open a partition from a VDI file (selecting by partition number 0–3)
-void closePartition(MBRPartition *partition); // Close a previously opened partition
+MBRPartition* openPartitionFlags(const char *filename, int part, int vdiFlags); // Same, with VDI_OPEN_* options
+MBRPartition* openPartitionOnImage(VDIFile *vdi, int part); // Partition view on an already open VDI (takes a reference to it)
+void closePartition(MBRPartition *partition); // Close a partition; the VDI closes with its last partition
 ssize_t vdiReadPartition(MBRPartition *partition, void *buf, size_t count); // Read bytes from the partition
+ssize_t vdiReadPartitionAt(MBRPartition *partition, void *buf, size_t count, off_t offset); // Read bytes at a partition offset without moving the cursor
 ssize_t writePartition(MBRPartition *partition, void *buf, size_t count); // Write bytes to the partition
 off_t vdiSeekPartition(MBRPartition *partition, off_t offset, int anchor); // Move the partition cursor (like lseek)
 void displayPartitionTable(MBRPartition *partition); // Print a human-readable view of the partition table
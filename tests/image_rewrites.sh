@@ -0,0 +1,129 @@
+#!/bin/sh
+# Check the code paths that rewrite a VDI (translation map, header, frame moves, truncation):
+# trim with hole punching and with compaction, committing a snapshot overlay (in memory and in a
+# side file), and the refusal to trim a fixed-size image. Every rewritten image must keep the
+# contents of its files and pass e2fsck -fn. Requires gcc, python3, mke2fs, debugfs and e2fsck.
+#
+#   tests/image_rewrites.sh [work-dir]
+set -eu
+
+repo=$(cd "$(dirname "$0")/.." && pwd)
+if [ $# -gt 0 ]; then
+    work=$1
+    keep=1
+else
+    work=$(mktemp -d)
+    keep=0
+fi
+mkdir -p "$work"
+prog="$work/prog"
+writer="$work/overlaywrite"
+mk="python3 $repo/tests/mksparsevdi.py"
+
+gcc -O2 -pthread -o "$prog" "$repo"/*.c
+gcc -O2 -pthread -I"$repo" -o "$writer" "$repo/tests/overlaywrite.c" $(ls "$repo"/*.c | grep -v '/main\.c$')
+
+# Big random files, half of which are deleted after the file system is built, so whole frames
+# end up holding nothing but free blocks with stale data in them
+rm -rf "$work/tree"
+mkdir -p "$work/tree/keep" "$work/tree/gone"
+i=0
+while [ $i -lt 6 ]; do
+    head -c 2500000 /dev/urandom > "$work/tree/keep/big$i"
+    head -c 2500000 /dev/urandom > "$work/tree/gone/big$i"
+    echo "small $i" > "$work/tree/keep/small$i"
+    i=$((i + 1))
+done
+rm -f "$work/fs.img"
+truncate -s 48M "$work/fs.img"
+mke2fs -q -t ext2 -b 1024 -d "$work/tree" "$work/fs.img"
+i=0
+while [ $i -lt 6 ]; do
+    debugfs -w -R "rm /gone/big$i" "$work/fs.img" > /dev/null 2>&1
+    i=$((i + 1))
+done
+rm -rf "$work/tree/gone"
+$mk "$work/fs.img" "$work/base.vdi" 2048
+$mk --fixed "$work/fs.img" "$work/fixed.vdi" 2048
+
+# "digest  /path" of every file that is still there, straight from the source tree
+(cd "$work/tree" && find . -type f | sed 's|^\.||' | sort | while read -r path; do
+    echo "$(sha256sum ".$path" | cut -d' ' -f1)  $path"
+done) > "$work/expected.sha256"
+
+fail=0
+failed() {
+    echo "FAIL: $1"
+    fail=1
+}
+
+framesAllocated() {  # Header offset 388
+    od -An -tu4 -j388 -N4 "$1" | tr -d ' '
+}
+
+verify() {  # verify IMAGE NAME: same file contents as the tree, and a clean e2fsck
+    "$prog" "$1" hash 2 > "$1.hash" 2>&1 || failed "$2: hash mode failed"
+    grep -E '^[0-9a-f]{64}  ' "$1.hash" | awk '{ print $1 "  " $4 }' | sort -k 2 > "$1.sha256" || true
+    cmp -s "$work/expected.sha256" "$1.sha256" || failed "$2: file digests differ from the source tree"
+    python3 "$repo/tests/vdiextract.py" "$1" "$work/check.img"
+    e2fsck -fn "$work/check.img" > "$1.fsck" 2>&1 || failed "$2: e2fsck -fn reports problems (see $1.fsck)"
+}
+
+verify "$work/base.vdi" "untouched image"
+
+# Trim, punching holes and compacting
+for mode in punch compact; do
+    image="$work/trim-$mode.vdi"
+    cp "$work/base.vdi" "$image"
+    before=$(framesAllocated "$image")
+    if [ $mode = compact ]; then
+        "$prog" "$image" trim compact > "$image.out" 2>&1 || failed "trim ($mode) failed"
+    else
+        "$prog" "$image" trim > "$image.out" 2>&1 || failed "trim ($mode) failed"
+    fi
+    released=$(sed -n 's/^Frames released ([a-z ]*): //p' "$image.out")
+    [ "${released:-0}" -gt 0 ] || failed "trim ($mode) released no frames"
+    if [ $mode = compact ]; then
+        [ "$(framesAllocated "$image")" -eq $((before - released)) ] || failed "trim ($mode): frame count not lowered"
+        [ "$(stat -c %s "$image")" -lt "$(stat -c %s "$work/base.vdi")" ] || failed "trim ($mode): file not truncated"
+    fi
+    verify "$image" "trim ($mode)"
+    echo "trim ($mode): $released frames released, checked"
+done
+
+# Snapshot commit, with the overlay in memory and in a side file
+for overlay in memory file; do
+    image="$work/commit-$overlay.vdi"
+    side=-
+    [ $overlay = memory ] || side="$work/overlay-$overlay"
+    cp "$work/base.vdi" "$image"
+    before=$(framesAllocated "$image")
+
+    rm -f "$work/overlay-$overlay"
+    "$writer" "$image" "$side" drop > /dev/null || failed "snapshot write ($overlay) failed"
+    cmp -s "$image" "$work/base.vdi" || failed "dropping the overlay ($overlay) changed the image"
+
+    rm -f "$work/overlay-$overlay"
+    block=$("$writer" "$image" "$side" commit) || failed "commit ($overlay) failed"
+    [ "$(framesAllocated "$image")" -eq $((before + 1)) ] || failed "commit ($overlay): no frame appended"
+    "$prog" "$image" | grep -qx 'Volume name: \[committed\]' || failed "commit ($overlay): superblock change missing"
+    "$prog" "$image" dump block "$block" 1 | head -n 1 | grep -q 'a5 a5 a5 a5 a5 a5 a5 a5  a5' ||
+        failed "commit ($overlay): block $block does not hold the written data"
+    verify "$image" "commit ($overlay)"
+    echo "commit ($overlay): checked"
+done
+
+# A fixed-size image has to keep a frame for every page, so trim must refuse it and leave it alone
+cp "$work/fixed.vdi" "$work/fixed-trim.vdi"
+if "$prog" "$work/fixed-trim.vdi" trim compact > "$work/fixed-trim.out" 2>&1; then
+    failed "trim accepted a fixed-size image"
+fi
+grep -q 'not dynamic' "$work/fixed-trim.out" || failed "trim of a fixed-size image did not say why it refused"
+cmp -s "$work/fixed-trim.vdi" "$work/fixed.vdi" || failed "trim changed a fixed-size image"
+echo "trim (fixed image): refused, checked"
+
+if [ $fail -eq 0 ]; then
+    echo "All image rewrite checks passed"
+    [ $keep -eq 1 ] || rm -rf "$work"
+fi
+exit $fail
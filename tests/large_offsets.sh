@@ -0,0 +1,96 @@
+#!/bin/sh
+# Check 64-bit addressing: the same ext2 file systems placed at a low offset, above 4 GiB and
+# straddling 2 TiB must give identical hash, manifest, freespace, inodes and dump output, and the
+# file digests read from every image must match sha256sum of the source tree.
+# The images are sparse, so this needs little disk space. Requires gcc, python3 and mke2fs.
+#
+#   tests/large_offsets.sh [work-dir]
+set -eu
+
+repo=$(cd "$(dirname "$0")/.." && pwd)
+if [ $# -gt 0 ]; then
+    work=$1
+    keep=1
+else
+    work=$(mktemp -d)
+    keep=0
+fi
+mkdir -p "$work"
+prog="$work/prog"
+mk="python3 $repo/tests/mksparsevdi.py"
+
+gcc -O2 -pthread -o "$prog" "$repo"/*.c
+
+# A small tree of files with known contents
+rm -rf "$work/tree"
+mkdir -p "$work/tree/a/b"
+i=0
+while [ $i -lt 50 ]; do
+    echo "file $i" > "$work/tree/a/f$i"
+    i=$((i + 1))
+done
+head -c 3000000 /dev/urandom > "$work/tree/a/b/big"
+
+# 16 MiB with 1 KiB blocks (2 groups), and 300 MiB with 1 KiB blocks (38 groups, multi-block BGDT)
+rm -f "$work/small.img" "$work/wide.img"
+truncate -s 16M "$work/small.img"
+truncate -s 300M "$work/wide.img"
+mke2fs -q -t ext2 -b 1024 -d "$work/tree" "$work/small.img"
+mke2fs -q -t ext2 -b 1024 -d "$work/tree" "$work/wide.img"
+
+# Ground truth for the hash mode: "digest  /path" of every file, straight from the source tree
+(cd "$work/tree" && find . -type f | sed 's|^\.||' | sort | while read -r path; do
+    echo "$(sha256sum ".$path" | cut -d' ' -f1)  $path"
+done) > "$work/expected.sha256"
+
+low=2048                      # 1 MiB
+above4g=10485760              # 5 GiB
+straddle2t=$((4294967296 - 16384))  # 2 TiB - 8 MiB: the 16 MiB file system crosses 2 TiB
+fail=0
+
+run() {  # run IMAGE OUTPUT-PREFIX; a failing mode records its exit status instead of stopping the script
+    "$prog" "$1" hash 2 > "$2.hash" 2>&1 || echo "exit $?" >> "$2.hash"
+    ("$prog" "$1" manifest csv 2 2>&1 || echo "exit $?") | sort > "$2.manifest"
+    "$prog" "$1" freespace 2 > "$2.freespace" 2>&1 || echo "exit $?" >> "$2.freespace"
+    "$prog" "$1" inodes 2 > "$2.inodes" 2>&1 || echo "exit $?" >> "$2.inodes"
+    "$prog" "$1" dump part 0 65536 > "$2.dump" 2>&1 || echo "exit $?" >> "$2.dump"
+}
+
+truth() {  # truth OUTPUT-PREFIX NAME: the digests must be the source files' own, not just self-consistent
+    grep -E '^[0-9a-f]{64}  ' "$1.hash" | awk '{ print $1 "  " $4 }' | sort -k 2 > "$1.sha256" || true
+    if ! cmp -s "$work/expected.sha256" "$1.sha256"; then
+        echo "FAIL: $2: file digests differ from sha256sum of the source tree"
+        fail=1
+    fi
+}
+
+check() {  # check FS START-SECTOR NAME
+    $mk "$work/$1.img" "$work/$1-$3.vdi" "$2"
+    run "$work/$1-$3.vdi" "$work/$1-$3"
+    truth "$work/$1-$3" "$1 at $3"
+    for kind in hash manifest freespace inodes dump; do
+        if ! cmp -s "$work/$1-low.$kind" "$work/$1-$3.$kind"; then
+            echo "FAIL: $1 at $3: $kind output differs from the low-offset image"
+            fail=1
+        fi
+    done
+    echo "$1 at $3 (sector $2): checked"
+}
+
+for fs in small wide; do
+    $mk "$work/$fs.img" "$work/$fs-low.vdi" $low
+    run "$work/$fs-low.vdi" "$work/$fs-low"
+    truth "$work/$fs-low" "$fs at low"
+    check $fs $above4g above4g
+done
+check small $straddle2t straddle2t
+
+# A raw read straddling the 2 TiB boundary of the virtual disk
+"$prog" "$work/small-straddle2t.vdi" dump disk $((2199023255552 - 4096)) 8192 > "$work/straddle.dump" 2>&1 || true
+tail -n 1 "$work/straddle.dump" | grep -qx "20000001000" || { echo "FAIL: disk dump across 2 TiB"; fail=1; }
+
+if [ $fail -eq 0 ]; then
+    echo "All large-offset checks passed"
+    [ $keep -eq 1 ] || rm -rf "$work"
+fi
+exit $fail
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# Build a sparse dynamic VDI holding one ext2 file system image as partition 0.
+#
+#   mksparsevdi.py [--fixed] FS.IMG OUT.VDI START_SECTOR
+#
+# The partition starts at START_SECTOR (a multiple of 2048); the disk in front of it is left
+# unallocated, so the VDI only stores the MBR and the non-zero 1 MiB frames of the file system.
+# With --fixed the image is fixed-size instead: every frame is stored, in order.
+import os
+import struct
+import sys
+
+FRAME = 1 << 20
+
+def main():
+    args = sys.argv[1:]
+    fixed = len(args) > 0 and args[0] == '--fixed'
+    if fixed:
+        args = args[1:]
+    if len(args) != 3:
+        sys.exit("usage: mksparsevdi.py [--fixed] FS.IMG OUT.VDI START_SECTOR")
+    fsPath, outPath, startSector = args[0], args[1], int(args[2])
+    fsSize = os.path.getsize(fsPath)
+    start = startSector * 512
+    if start % FRAME or fsSize % 512 or startSector >= 1 << 32:
+        sys.exit("start must be 1 MiB aligned and below 2^32 sectors, the image a whole number of sectors")
+
+    diskSize = (start + fsSize + FRAME - 1) // FRAME * FRAME
+    totalFrames = diskSize // FRAME
+
+    mbr = bytearray(FRAME)
+    mbr[446:462] = struct.pack('<B3sB3sII', 0, b'\0' * 3, 0x83, b'\0' * 3, startSector, fsSize // 512)
+    mbr[510:512] = b'\x55\xaa'
+
+    blockMap = [0xFFFFFFFF] * totalFrames
+    frames = [bytes(mbr)]
+    blockMap[0] = 0
+    if fixed:
+        for page in range(1, start // FRAME):  # Zero frames in front of the partition are stored too
+            blockMap[page] = len(frames)
+            frames.append(bytes(FRAME))
+    with open(fsPath, 'rb') as fs:
+        page = start // FRAME
+        while True:
+            chunk = fs.read(FRAME)
+            if not chunk:
+                break
+            chunk = chunk.ljust(FRAME, b'\0')
+            if fixed or chunk.count(0) != FRAME:
+                blockMap[page] = len(frames)
+                frames.append(chunk)
+            page += 1
+
+    mapOffset = 512
+    frameOffset = (mapOffset + totalFrames * 4 + FRAME - 1) // FRAME * FRAME
+    header = bytearray(512)
+    header[0:64] = b'<<< Oracle VM VirtualBox Disk Image >>>\n'.ljust(64, b'\0')
+    struct.pack_into('<IIIII', header, 64, 0xbeda107f, 0x00010001, 400, 2 if fixed else 1, 0)  # Fixed or dynamic
+    struct.pack_into('<II', header, 340, mapOffset, frameOffset)
+    struct.pack_into('<IIII', header, 348, 0, 0, 0, 512)
+    struct.pack_into('<QIIII', header, 368, diskSize, FRAME, 0, totalFrames, len(frames))
+
+    with open(outPath, 'wb') as out:
+        out.write(header)
+        out.seek(mapOffset)
+        out.write(struct.pack('<%dI' % totalFrames, *blockMap))
+        out.seek(frameOffset)
+        for frame in frames:
+            out.write(frame)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,59 @@
+// Write through a snapshot, then commit or drop the overlay; driven by tests/image_rewrites.sh.
+//
+//   overlaywrite IMAGE OVERLAY|- commit|drop
+//
+// Renames the volume to "committed" in the main superblock and fills one free block in a page the
+// image never allocated with 0xa5, so a commit has to both rewrite an existing frame and append a
+// new one. Prints that block's number. OVERLAY is a side file for the slots, "-" keeps them in memory.
+#include "ext2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 || (strcmp(argv[3], "commit") != 0 && strcmp(argv[3], "drop") != 0)) {
+        printf("Usage: %s IMAGE OVERLAY|- commit|drop\n", argv[0]);
+        return 2;
+    }
+    const char *overlay = (strcmp(argv[2], "-") == 0) ? NULL : argv[2];
+    VDIFile *vdi = vdiOpenSnapshot(argv[1], overlay, 0);
+    if (!vdi) return 1;
+    struct Ext2File *f = openExt2OnImage(vdi, -1);
+    if (!f) {
+        vdiClose(vdi);
+        return 1;
+    }
+
+    // First block of the first unallocated page that lies wholly inside the file system
+    uint64_t partStart = (uint64_t)f->partition->startSector * 512;
+    uint64_t partEnd = partStart + (uint64_t)f->partition->sectorCount * 512;
+    uint32_t blockNum = 0;
+    for (uint32_t page = 0; page < vdi->totalPages && blockNum == 0; page++) {
+        uint64_t pageStart = (uint64_t)page * vdi->pageSize;
+        if (vdi->map[page] < 0xFFFFFFFE || pageStart < partStart || pageStart + vdi->pageSize > partEnd) continue;
+        blockNum = (pageStart - partStart + f->blockSize - 1) / f->blockSize;
+    }
+    uint8_t *block = bufferPoolGet(&f->blockPool);
+    if (blockNum == 0 || !block) {
+        printf("No unallocated page inside the file system\n");
+        bufferPoolPut(&f->blockPool, block);
+        closeExt2(f);
+        vdiClose(vdi);
+        return 1;
+    }
+    memset(block, 0xa5, f->blockSize);
+
+    strcpy(f->superblock.s_volume_name, "committed");
+    bool ok = writeSuperblock(f, 0, &f->superblock) && writeBlock(f, blockNum, block);
+    bufferPoolPut(&f->blockPool, block);
+    if (ok && strcmp(argv[3], "commit") == 0) {
+        ok = vdiCommitOverlay(vdi) == 2;  // The superblock's page and the new one
+    } else if (ok) {
+        vdiDropOverlay(vdi);
+    }
+    printf("%u\n", blockNum);
+
+    closeExt2(f);
+    vdiClose(vdi);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+# Copy partition 0 of a VDI out to a raw file system image, so host tools such as e2fsck can check it.
+#
+#   vdiextract.py IN.VDI OUT.IMG
+#
+# Pages the map leaves unallocated read back as zeros, as they do through vdiReadAt().
+import struct
+import sys
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: vdiextract.py IN.VDI OUT.IMG")
+    with open(sys.argv[1], 'rb') as vdi:
+        header = vdi.read(400)
+        mapOffset, frameOffset = struct.unpack_from('<II', header, 340)
+        frameSize, totalFrames = struct.unpack_from('<I4xI', header, 376)
+        vdi.seek(mapOffset)
+        blockMap = struct.unpack('<%dI' % totalFrames, vdi.read(totalFrames * 4))
+
+        def readDisk(offset, length):
+            data = bytearray()
+            while length > 0:
+                page, inPage = divmod(offset, frameSize)
+                take = min(length, frameSize - inPage)
+                if blockMap[page] >= 0xFFFFFFFE:
+                    data += bytes(take)
+                else:
+                    vdi.seek(frameOffset + blockMap[page] * frameSize + inPage)
+                    data += vdi.read(take).ljust(take, b'\0')
+                offset += take
+                length -= take
+            return bytes(data)
+
+        mbr = readDisk(0, 512)
+        startSector, sectorCount = struct.unpack_from('<II', mbr, 446 + 8)
+        start, size = startSector * 512, sectorCount * 512
+        with open(sys.argv[2], 'wb') as out:
+            for done in range(0, size, frameSize):
+                out.write(readDisk(start + done, min(frameSize, size - done)))
+
+if __name__ == '__main__':
+    main()
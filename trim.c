@@ -0,0 +1,76 @@
+#include "trim.h"
+#include "freespace.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// Is every block in [first, last] marked free? Blocks outside the bitmaps count as used.
+static bool blocksFree(struct Ext2File *f, const uint8_t *bitmaps, uint64_t first, uint64_t last) {
+    Ext2Superblock *sb = &f->superblock;
+    if (first < sb->s_first_data_block || last >= sb->s_blocks_count) return false;
+
+    for (uint64_t b = first; b <= last; b++) {
+        uint64_t index = b - sb->s_first_data_block;
+        uint32_t group = index / sb->s_blocks_per_group;
+        uint32_t bit = index % sb->s_blocks_per_group;
+        if (bitmaps[(size_t)group * f->blockSize + bit / 8] & (1 << (bit % 8))) return false;
+    }
+    return true;
+}
+
+bool trimExt2(struct Ext2File *f, bool compact, FILE *out) {
+    VDIFile *vdi = f->partition->vdi;
+    uint32_t imageType = *(uint32_t *)(vdi->header + 76);
+    if (imageType != VDI_IMAGE_DYNAMIC) {
+        fprintf(out, "Image type is %u, not dynamic (%u): only dynamic images can release frames, nothing trimmed\n",
+                imageType, VDI_IMAGE_DYNAMIC);
+        return false;
+    }
+
+    uint8_t *bitmaps = fetchBlockBitmaps(f, 0);
+    uint8_t *discard = calloc(vdi->totalPages, 1);
+    if (!bitmaps || !discard) {
+        printf("Failed to prepare trim\n");
+        free(bitmaps);
+        free(discard);
+        return false;
+    }
+
+    // Only frames lying entirely inside the ext2 partition are candidates
+    off_t partStart = (off_t)f->partition->startSector * 512;
+    off_t partEnd = partStart + (off_t)f->partition->sectorCount * 512;
+    uint32_t allocated = 0, candidates = 0;
+    for (uint32_t page = 0; page < vdi->totalPages; page++) {
+        if (vdi->map[page] >= 0xFFFFFFFE) continue;  // Already unallocated
+        allocated++;
+
+        off_t frameStart = (off_t)page * vdi->pageSize;
+        off_t frameEnd = frameStart + vdi->pageSize;
+        if (frameStart < partStart || frameEnd > partEnd) continue;
+
+        uint64_t first = (frameStart - partStart) / f->blockSize;
+        uint64_t last = (frameEnd - partStart - 1) / f->blockSize;
+        if (blocksFree(f, bitmaps, first, last)) {
+            discard[page] = 1;
+            candidates++;
+        }
+    }
+    free(bitmaps);
+
+    struct stat before, after;
+    fstat(vdi->fd, &before);
+    int discarded = (candidates > 0) ? vdiDiscardPages(vdi, discard, compact) : 0;
+    fstat(vdi->fd, &after);
+    free(discard);
+
+    fprintf(out, "Allocated frames: %u\n", allocated);
+    fprintf(out, "Frames covering only free blocks: %u\n", candidates);
+    if (discarded < 0) {
+        fprintf(out, "Trim failed, the image was left with a consistent map\n");
+        return false;
+    }
+    fprintf(out, "Frames released (%s): %d\n", compact ? "compacted" : "hole punched", discarded);
+    fprintf(out, "Frames allocated now: %u\n", *(uint32_t *)(vdi->header + 388));
+    fprintf(out, "File size: %lld -> %lld bytes\n", (long long)before.st_size, (long long)after.st_size);
+    fprintf(out, "Disk usage: %lld -> %lld bytes\n", (long long)before.st_blocks * 512, (long long)after.st_blocks * 512);
+    return true;
+}
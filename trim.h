@@ -0,0 +1,13 @@
+#ifndef TRIM_H
+#define TRIM_H
+
+#include "ext2.h"
+#include <stdio.h>
+
+// Shrink the image: unmap every VDI frame whose blocks are all free in the ext2 block bitmaps and
+// release its space, either by punching a hole in the file or, with compact, by moving the last
+// frames into the freed slots and truncating. Only dynamic images can be trimmed; a fixed image is
+// refused. Writes a summary to out. Returns false on error.
+bool trimExt2(struct Ext2File *f, bool compact, FILE *out);
+
+#endif
@@ -1,15 +1,23 @@
+#define _GNU_SOURCE   // For O_DIRECT
 #include "vdi.h"
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 // --- Open a VDI file and initialize VDIFile struct ---
 VDIFile *vdiOpen(const char *filename) {
+    return vdiOpenFlags(filename, 0);
+}
+
+// --- Open a VDI file with options (VDI_OPEN_DIRECT bypasses the page cache) ---
+VDIFile *vdiOpenFlags(const char *filename, int flags) {
     VDIFile *vdi = malloc(sizeof(VDIFile));    // Allocate memory for VDIFile
     if (!vdi) return NULL;                     // Return NULL if allocation failed
 
-    vdi->fd = open(filename, O_RDWR);           // Open file read/write
+    bool snapshot = (flags & VDI_OPEN_SNAPSHOT) != 0;
+    vdi->fd = open(filename, snapshot ? O_RDONLY : O_RDWR); // Snapshots never write the file itself
     if (vdi->fd == -1) {                        // Error opening file
         perror("Error opening VDI file");
         free(vdi);
@@ -24,13 +32,15 @@ VDIFile *vdiOpen(const char *filename) {
         return NULL;
     }
 
-    // Extract fields needed (pageSize and totalPages)
-    vdi->pageSize = *(uint32_t *)(vdi->header + 36);   // Read page size at offset 36
-    vdi->totalPages = *(uint32_t *)(vdi->header + 40); // Read total pages at offset 40
+    // Extract fields needed (pageSize, totalPages and frameOffset)
+    vdi->pageSize = *(uint32_t *)(vdi->header + 376);   // Read page size at offset 376
+    vdi->totalPages = *(uint32_t *)(vdi->header + 384); // Read total pages at offset 384
+    vdi->frameOffset = *(uint32_t *)(vdi->header + 344); // Read frame offset at offset 344
+    memcpy(&vdi->diskSize, vdi->header + 368, sizeof(uint64_t)); // Read virtual disk size at offset 368 (not 8-byte aligned)
 
     // Read the translation map (block map)
-    off_t mapOffset = *(off_t *)(vdi->header + 16);    // Offset where map starts
-    lseek(vdi->fd, mapOffset, SEEK_SET);               // Seek to map
+    vdi->mapOffset = *(uint32_t *)(vdi->header + 340); // Offset where map starts
+    lseek(vdi->fd, vdi->mapOffset, SEEK_SET);          // Seek to map
     vdi->map = malloc(vdi->totalPages * sizeof(uint32_t)); // Allocate space for map
     if (!vdi->map) {
         perror("Error allocating memory for translation map");
@@ -40,67 +50,531 @@ VDIFile *vdiOpen(const char *filename) {
     }
     read(vdi->fd, vdi->map, vdi->totalPages * sizeof(uint32_t)); // Read map
 
+    // Snapshot overlay: starts empty, slots are kept in memory unless vdiOpenSnapshot() gives a side file
+    vdi->path = NULL;
+    vdi->overlayMap = NULL;
+    vdi->overlayFrames = NULL;
+    vdi->overlaySlots = 0;
+    vdi->overlayCapacity = 0;
+    vdi->overlayFd = -1;
+    if (snapshot) {
+        vdi->path = strdup(filename);
+        vdi->overlayMap = malloc(vdi->totalPages * sizeof(uint32_t));
+        if (!vdi->path || !vdi->overlayMap) {
+            perror("Error allocating memory for snapshot overlay");
+            close(vdi->fd);
+            free(vdi->map);
+            free(vdi->path);
+            free(vdi->overlayMap);
+            free(vdi);
+            return NULL;
+        }
+        memset(vdi->overlayMap, 0xFF, vdi->totalPages * sizeof(uint32_t));  // All VDI_OVERLAY_NONE
+    }
+    pthread_rwlock_init(&vdi->overlayLock, NULL);
+
+    // Switch to O_DIRECT only now, so the unaligned header and map reads above stay simple
+    vdi->direct = false;
+    if (flags & VDI_OPEN_DIRECT) {
+        int fileFlags = fcntl(vdi->fd, F_GETFL);
+        if (fileFlags != -1 && fcntl(vdi->fd, F_SETFL, fileFlags | O_DIRECT) == 0) {
+            vdi->direct = true;
+        } else {
+            perror("O_DIRECT not available, using buffered I/O");
+        }
+    }
+    // Bounce buffers: a page plus room to round its start and end out to the alignment
+    bufferPoolInit(&vdi->framePool, vdi->pageSize + 2 * BUFPOOL_ALIGN);
+
     vdi->cursor = 0;  // Initialize cursor to start
+    atomic_init(&vdi->refCount, 1);  // Held by the caller
+    return vdi;
+}
+
+// --- Open a snapshot whose overlay slots go to a side file instead of memory ---
+// The side file is scratch space: it is unlinked right away and disappears when the image is closed.
+VDIFile *vdiOpenSnapshot(const char *filename, const char *overlayPath, int flags) {
+    VDIFile *vdi = vdiOpenFlags(filename, flags | VDI_OPEN_SNAPSHOT);
+    if (!vdi || !overlayPath) return vdi;
+
+    vdi->overlayFd = open(overlayPath, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (vdi->overlayFd == -1) {
+        perror("Error creating overlay file");
+        vdiClose(vdi);
+        return NULL;
+    }
+    unlink(overlayPath);
     return vdi;
 }
 
-// --- Close VDI file and free resources ---
+// --- Share an open VDI file; every vdiRetain() needs a matching vdiClose() ---
+VDIFile *vdiRetain(VDIFile *vdi) {
+    if (vdi) atomic_fetch_add(&vdi->refCount, 1);
+    return vdi;
+}
+
+// --- Drop a reference; close the VDI file and free resources once nobody uses it ---
 void vdiClose(VDIFile *vdi) {
-    if (vdi) {
+    if (vdi && atomic_fetch_sub(&vdi->refCount, 1) == 1) {
         close(vdi->fd);       // Close file
         free(vdi->map);       // Free translation map
+        bufferPoolDestroy(&vdi->framePool); // Free pooled frame buffers
+        for (uint32_t i = 0; vdi->overlayFrames && i < vdi->overlaySlots; i++) free(vdi->overlayFrames[i]);
+        free(vdi->overlayFrames);
+        free(vdi->overlayMap);
+        free(vdi->path);
+        if (vdi->overlayFd != -1) close(vdi->overlayFd);
+        pthread_rwlock_destroy(&vdi->overlayLock);
         free(vdi);            // Free VDIFile struct
     }
 }
 
+// --- Read from the file itself; in O_DIRECT mode unaligned requests go through a pooled bounce buffer ---
+static ssize_t readPhysical(VDIFile *vdi, void *buf, size_t count, off_t offset) {
+    off_t start = offset & ~(off_t)(BUFPOOL_ALIGN - 1);
+    off_t end = (offset + count + BUFPOOL_ALIGN - 1) & ~(off_t)(BUFPOOL_ALIGN - 1);
+    if (!vdi->direct || (start == offset && end == offset + (off_t)count && (uintptr_t)buf % BUFPOOL_ALIGN == 0)) {
+        return pread(vdi->fd, buf, count, offset);    // Caller's request can be used as is
+    }
+
+    uint8_t *bounce = bufferPoolGet(&vdi->framePool);
+    if (!bounce) return -1;
+    ssize_t got = pread(vdi->fd, bounce, end - start, start);
+    ssize_t result = got;
+    if (got > 0) {
+        result = got - (offset - start);              // Bytes past the requested start
+        if (result < 0) result = 0;
+        if (result > (ssize_t)count) result = count;
+        memcpy(buf, bounce + (offset - start), result);
+    }
+    bufferPoolPut(&vdi->framePool, bounce);
+    return result;
+}
+
+// --- Write to the file itself; in O_DIRECT mode partial alignment units are read, patched and rewritten ---
+static ssize_t writePhysical(VDIFile *vdi, const void *buf, size_t count, off_t offset) {
+    off_t start = offset & ~(off_t)(BUFPOOL_ALIGN - 1);
+    off_t end = (offset + count + BUFPOOL_ALIGN - 1) & ~(off_t)(BUFPOOL_ALIGN - 1);
+    if (!vdi->direct || (start == offset && end == offset + (off_t)count && (uintptr_t)buf % BUFPOOL_ALIGN == 0)) {
+        return pwrite(vdi->fd, buf, count, offset);
+    }
+
+    uint8_t *bounce = bufferPoolGet(&vdi->framePool);
+    if (!bounce) return -1;
+    ssize_t got = pread(vdi->fd, bounce, end - start, start);
+    if (got < 0) got = 0;
+    if (got < end - start) memset(bounce + got, 0, (end - start) - got);  // Past the end of the file
+    memcpy(bounce + (offset - start), buf, count);
+    ssize_t result = pwrite(vdi->fd, bounce, end - start, start);
+    bufferPoolPut(&vdi->framePool, bounce);
+    if (result < (offset - start) + (ssize_t)count) return -1;
+    return count;
+}
+
+// --- Read a whole page as the base file holds it (unallocated pages are zeros) ---
+static bool readBasePage(VDIFile *vdi, uint32_t page, uint8_t *frame) {
+    off_t physicalOffset = vdiTranslate(vdi, (off_t)page * vdi->pageSize);
+    if (physicalOffset == -1) {
+        memset(frame, 0, vdi->pageSize);
+        return true;
+    }
+    return readPhysical(vdi, frame, vdi->pageSize, physicalOffset) == (ssize_t)vdi->pageSize;
+}
+
+// --- Read from the snapshot overlay; returns 0 if the page has not been written ---
+// Readers share the lock, so parallel walks of a snapshot only wait while a page is being written.
+static ssize_t overlayRead(VDIFile *vdi, void *buf, size_t count, off_t offset) {
+    uint32_t page = offset / vdi->pageSize;
+    size_t inPage = offset % vdi->pageSize;
+    ssize_t result = 0;
+
+    pthread_rwlock_rdlock(&vdi->overlayLock);
+    uint32_t slot = vdi->overlayMap[page];
+    if (slot != VDI_OVERLAY_NONE) {
+        if (vdi->overlayFd == -1) {
+            memcpy(buf, vdi->overlayFrames[slot] + inPage, count);
+            result = count;
+        } else {
+            result = pread(vdi->overlayFd, buf, count, (off_t)slot * vdi->pageSize + inPage);
+            if (result != (ssize_t)count) result = -1;
+        }
+    }
+    pthread_rwlock_unlock(&vdi->overlayLock);
+    return result;
+}
+
+// --- Give a page its overlay slot, filled with the page's current base contents ---
+static bool newOverlaySlot(VDIFile *vdi, uint32_t page) {
+    uint32_t slot = vdi->overlaySlots;
+    if (vdi->overlayFd == -1) {
+        if (slot == vdi->overlayCapacity) {
+            uint32_t capacity = vdi->overlayCapacity ? vdi->overlayCapacity * 2 : 16;
+            uint8_t **frames = realloc(vdi->overlayFrames, capacity * sizeof(uint8_t *));
+            if (!frames) return false;
+            vdi->overlayFrames = frames;
+            vdi->overlayCapacity = capacity;
+        }
+        void *frame;
+        if (posix_memalign(&frame, BUFPOOL_ALIGN, vdi->pageSize) != 0) return false;
+        if (!readBasePage(vdi, page, frame)) {
+            free(frame);
+            return false;
+        }
+        vdi->overlayFrames[slot] = frame;
+    } else {
+        uint8_t *frame = bufferPoolGet(&vdi->framePool);
+        bool copied = frame && readBasePage(vdi, page, frame) &&
+                      pwrite(vdi->overlayFd, frame, vdi->pageSize, (off_t)slot * vdi->pageSize) == (ssize_t)vdi->pageSize;
+        bufferPoolPut(&vdi->framePool, frame);
+        if (!copied) return false;
+    }
+    vdi->overlaySlots++;
+    vdi->overlayMap[page] = slot;
+    return true;
+}
+
+// --- Write into the snapshot overlay, copying the base page into a new slot on its first write ---
+static ssize_t overlayWrite(VDIFile *vdi, const void *buf, size_t count, off_t offset) {
+    uint32_t page = offset / vdi->pageSize;
+    size_t inPage = offset % vdi->pageSize;
+    ssize_t result = -1;
+
+    pthread_rwlock_wrlock(&vdi->overlayLock);
+    if (vdi->overlayMap[page] != VDI_OVERLAY_NONE || newOverlaySlot(vdi, page)) {
+        uint32_t slot = vdi->overlayMap[page];
+        if (vdi->overlayFd == -1) {
+            memcpy(vdi->overlayFrames[slot] + inPage, buf, count);
+            result = count;
+        } else {
+            result = pwrite(vdi->overlayFd, buf, count, (off_t)slot * vdi->pageSize + inPage);
+        }
+    }
+    if (result == -1) perror("Error writing snapshot overlay");
+    pthread_rwlock_unlock(&vdi->overlayLock);
+    return result;
+}
+
 // --- Read data from VDI file at logical position ---
 ssize_t vdiRead(VDIFile *vdi, void *buf, size_t count) {
+    ssize_t result = vdiReadAt(vdi, buf, count, vdi->cursor);
+    if (result > 0) vdi->cursor += result;
+    return result;
+}
+
+// --- Read data at a logical offset without touching the cursor (safe to call from several threads) ---
+ssize_t vdiReadAt(VDIFile *vdi, void *buf, size_t count, off_t offset) {
     size_t bytesRead = 0;
     uint8_t *buffer = (uint8_t *)buf;
 
     while (count > 0) {
-        off_t physicalOffset = vdiTranslate(vdi, vdi->cursor); // Translate logical to physical
-        if (physicalOffset == -1) return -1;                   // If invalid, error
+        if (offset < 0 || offset / vdi->pageSize >= vdi->totalPages) break; // Before the start or past the end of the disk
 
-        size_t pageRemaining = vdi->pageSize - (vdi->cursor % vdi->pageSize); // How much left in current page
-        size_t toRead = (count < pageRemaining) ? count : pageRemaining;     // Read either what's left or requested count
+        size_t pageRemaining = vdi->pageSize - (offset % vdi->pageSize); // How much left in current page
+        size_t toRead = (count < pageRemaining) ? count : pageRemaining;
 
-        lseek(vdi->fd, physicalOffset, SEEK_SET);   // Move to correct physical offset
-        ssize_t result = read(vdi->fd, buffer, toRead); // Read data
+        ssize_t result = 0;
+        if (vdi->overlayMap) result = overlayRead(vdi, buffer, toRead, offset); // Snapshot: written pages come from the overlay
+        if (result == 0) {
+            off_t physicalOffset = vdiTranslate(vdi, offset);
+            if (physicalOffset == -1) {
+                memset(buffer, 0, toRead);                  // Unallocated pages read back as zeros
+                result = toRead;
+            } else {
+                result = readPhysical(vdi, buffer, toRead, physicalOffset);
+            }
+        }
         if (result <= 0) break;
 
         bytesRead += result;
         buffer += result;
         count -= result;
-        vdi->cursor += result;
+        offset += result;
     }
     return bytesRead;
 }
 
 // --- Write data to VDI file at logical position ---
 ssize_t vdiWrite(VDIFile *vdi, void *buf, size_t count) {
+    ssize_t result = vdiWriteAt(vdi, buf, count, vdi->cursor);
+    if (result > 0) vdi->cursor += result;
+    return result;
+}
+
+// --- Write data at a logical offset without touching the cursor ---
+ssize_t vdiWriteAt(VDIFile *vdi, void *buf, size_t count, off_t offset) {
     size_t bytesWritten = 0;
     uint8_t *buffer = (uint8_t *)buf;
 
     while (count > 0) {
-        off_t physicalOffset = vdiTranslate(vdi, vdi->cursor); // Translate logical to physical
-        if (physicalOffset == -1) return bytesWritten;         // Can't write to unallocated blocks yet
+        size_t pageRemaining = vdi->pageSize - (offset % vdi->pageSize); // Remaining space in page
+        size_t toWrite = (count < pageRemaining) ? count : pageRemaining; // How much we can write now
 
-        size_t pageRemaining = vdi->pageSize - (vdi->cursor % vdi->pageSize); // Remaining space in page
-        size_t toWrite = (count < pageRemaining) ? count : pageRemaining;     // How much we can write now
-
-        lseek(vdi->fd, physicalOffset, SEEK_SET);  // Seek to correct position
-        ssize_t result = write(vdi->fd, buffer, toWrite);  // Write data
+        ssize_t result;
+        if (vdi->overlayMap) {
+            if (offset < 0 || offset / vdi->pageSize >= vdi->totalPages) break; // Past the end of the disk
+            result = overlayWrite(vdi, buffer, toWrite, offset);                // Snapshot: the file itself is never written
+        } else {
+            off_t physicalOffset = vdiTranslate(vdi, offset);  // Translate logical to physical
+            if (physicalOffset == -1) return bytesWritten;     // Can't write to unallocated blocks yet
+            result = writePhysical(vdi, buffer, toWrite, physicalOffset);
+        }
         if (result <= 0) break;
 
         bytesWritten += result;
         buffer += result;
         count -= result;
-        vdi->cursor += result;
+        offset += result;
     }
     return bytesWritten;
 }
 
+// --- Write the translation map and the allocated-frame count back to the file ---
+static bool writeMap(VDIFile *vdi, uint32_t framesAllocated) {
+    *(uint32_t *)(vdi->header + 388) = framesAllocated;  // Frames allocated lives at offset 388
+    if (writePhysical(vdi, vdi->header + 388, 4, 388) != 4) return false;
+
+    // At most a page at a time, the size of the O_DIRECT bounce buffers
+    size_t mapBytes = (size_t)vdi->totalPages * sizeof(uint32_t);
+    for (size_t done = 0; done < mapBytes; done += vdi->pageSize) {
+        size_t chunk = (mapBytes - done < vdi->pageSize) ? mapBytes - done : vdi->pageSize;
+        if (writePhysical(vdi, (uint8_t *)vdi->map + done, chunk, vdi->mapOffset + done) != (ssize_t)chunk) return false;
+    }
+    return fsync(vdi->fd) == 0;
+}
+
+// --- Unmap the pages flagged in discard[] (one byte per page) and give their frames back ---
+// Without compact the frames are punched out of the file and only trailing free frames are truncated.
+// With compact the last frames are moved into the freed slots and the file is truncated after them.
+// Returns the number of pages unmapped, or -1 if the image could not be updated.
+int vdiDiscardPages(VDIFile *vdi, const uint8_t *discard, bool compact) {
+    if (vdi->overlayMap) {
+        printf("Cannot discard pages of a read-only snapshot\n");
+        return -1;
+    }
+    if (*(uint32_t *)(vdi->header + 76) != VDI_IMAGE_DYNAMIC) {
+        printf("Cannot discard pages of a fixed-size image\n");  // A fixed image must keep a frame for every page
+        return -1;
+    }
+
+    uint32_t framesAllocated = *(uint32_t *)(vdi->header + 388);
+    uint8_t *slotUsed = calloc(framesAllocated ? framesAllocated : 1, 1);             // Frame slots still holding data
+    uint32_t *owner = malloc((framesAllocated ? framesAllocated : 1) * sizeof(uint32_t)); // Page stored in each slot
+    if (!slotUsed || !owner) {
+        perror("Error allocating memory for frame slots");
+        free(slotUsed);
+        free(owner);
+        return -1;
+    }
+
+    int discarded = 0;
+    bool punchFailed = false;
+    for (uint32_t page = 0; page < vdi->totalPages; page++) {
+        uint32_t slot = vdi->map[page];
+        if (slot >= 0xFFFFFFFE || slot >= framesAllocated) continue;  // Not backed by a frame
+        if (!discard[page]) {
+            slotUsed[slot] = 1;
+            owner[slot] = page;
+            continue;
+        }
+
+        vdi->map[page] = 0xFFFFFFFF;
+        discarded++;
+        if (!compact && !punchFailed &&
+            fallocate(vdi->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      vdi->frameOffset + (off_t)slot * vdi->pageSize, vdi->pageSize) != 0) {
+            perror("Hole punching not supported, frames are only unmapped");
+            punchFailed = true;
+        }
+    }
+
+    uint32_t newAllocated = framesAllocated;
+    bool ok = true;
+    if (compact) {
+        // Fill the lowest free slot with the highest used one until the used slots are contiguous
+        uint8_t *frame = bufferPoolGet(&vdi->framePool);
+        uint32_t low = 0, high = framesAllocated;
+        while (frame) {
+            while (low < high && slotUsed[low]) low++;
+            while (high > low && !slotUsed[high - 1]) high--;
+            if (low >= high) break;
+
+            uint32_t from = high - 1;
+            if (readPhysical(vdi, frame, vdi->pageSize, vdi->frameOffset + (off_t)from * vdi->pageSize) != (ssize_t)vdi->pageSize ||
+                writePhysical(vdi, frame, vdi->pageSize, vdi->frameOffset + (off_t)low * vdi->pageSize) != (ssize_t)vdi->pageSize) {
+                perror("Error moving frame");
+                ok = false;
+                break;
+            }
+            vdi->map[owner[from]] = low;
+            slotUsed[low] = 1;
+            slotUsed[from] = 0;
+        }
+        if (!frame) ok = false;
+        bufferPoolPut(&vdi->framePool, frame);
+        if (ok) newAllocated = high;
+
+        // Moved frames must be on disk before the map that points at them
+        if (fsync(vdi->fd) != 0) ok = false;
+    } else {
+        while (newAllocated > 0 && !slotUsed[newAllocated - 1]) newAllocated--;
+    }
+
+    if (!writeMap(vdi, newAllocated)) {
+        perror("Error writing translation map");
+        ok = false;
+    } else if (newAllocated < framesAllocated &&
+               ftruncate(vdi->fd, vdi->frameOffset + (off_t)newAllocated * vdi->pageSize) != 0) {
+        perror("Error truncating VDI file");
+    }
+
+    free(slotUsed);
+    free(owner);
+    return ok ? discarded : -1;
+}
+
+// --- Number of pages a snapshot has copied into its overlay ---
+uint32_t vdiOverlayPages(VDIFile *vdi) {
+    if (!vdi->overlayMap) return 0;
+    pthread_rwlock_rdlock(&vdi->overlayLock);
+    uint32_t pages = vdi->overlaySlots;
+    pthread_rwlock_unlock(&vdi->overlayLock);
+    return pages;
+}
+
+// --- Empty the overlay; the snapshot reads the base file again ---
+static void clearOverlay(VDIFile *vdi) {
+    for (uint32_t i = 0; vdi->overlayFrames && i < vdi->overlaySlots; i++) free(vdi->overlayFrames[i]);
+    memset(vdi->overlayMap, 0xFF, vdi->totalPages * sizeof(uint32_t));  // All VDI_OVERLAY_NONE
+    vdi->overlaySlots = 0;
+    if (vdi->overlayFd != -1 && ftruncate(vdi->overlayFd, 0) != 0) perror("Error truncating overlay file");
+}
+
+void vdiDropOverlay(VDIFile *vdi) {
+    if (!vdi->overlayMap) return;
+    pthread_rwlock_wrlock(&vdi->overlayLock);
+    clearOverlay(vdi);
+    pthread_rwlock_unlock(&vdi->overlayLock);
+}
+
+typedef struct {
+    uint32_t page;   // Logical page
+    uint32_t slot;   // Overlay slot holding its new contents
+    uint32_t frame;  // Frame it goes to in the base file
+} CommitEntry;
+
+static int compareCommitFrames(const void *a, const void *b) {
+    uint32_t x = ((const CommitEntry *)a)->frame, y = ((const CommitEntry *)b)->frame;
+    return (x > y) - (x < y);
+}
+
+// --- Open the snapshot's image again for writing, through the descriptor it was opened with ---
+// The name may since have been renamed or replaced, or be relative to an old working directory, so the
+// new descriptor must be the very file being read before anything is written through it.
+static int reopenWritable(VDIFile *vdi) {
+    int flags = vdi->direct ? O_RDWR | O_DIRECT : O_RDWR;
+    char procPath[64];
+    snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", vdi->fd);
+    int fd = open(procPath, flags);
+    if (fd == -1) fd = open(vdi->path, flags);  // No /proc: fall back to the name, checked below
+    if (fd == -1) {
+        perror("Error reopening VDI file for commit");
+        return -1;
+    }
+
+    struct stat base, reopened;
+    if (fstat(vdi->fd, &base) != 0 || fstat(fd, &reopened) != 0 ||
+        base.st_dev != reopened.st_dev || base.st_ino != reopened.st_ino) {
+        printf("%s is no longer the snapshot's image, nothing committed\n", vdi->path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// --- Write every overlay page into the base file, then empty the overlay ---
+// Pages are written whole in frame order; pages the base never allocated get frames appended after
+// the last one, and the map is rewritten once after the frames are on disk. No other I/O may use the
+// image while this runs. Returns the number of pages written, or -1 (the overlay is kept on failure).
+int vdiCommitOverlay(VDIFile *vdi) {
+    if (!vdi->overlayMap) {
+        printf("Image is not a snapshot, nothing to commit\n");
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&vdi->overlayLock);
+    uint32_t count = vdi->overlaySlots;
+    if (count == 0) {
+        pthread_rwlock_unlock(&vdi->overlayLock);
+        return 0;
+    }
+
+    int rwFd = reopenWritable(vdi);
+    if (rwFd == -1) {
+        pthread_rwlock_unlock(&vdi->overlayLock);
+        return -1;
+    }
+
+    CommitEntry *entries = malloc(count * sizeof(CommitEntry));
+    uint32_t *oldMap = malloc(vdi->totalPages * sizeof(uint32_t));
+    if (!entries || !oldMap) {
+        perror("Error preparing overlay commit");
+        close(rwFd);
+        free(entries);
+        free(oldMap);
+        pthread_rwlock_unlock(&vdi->overlayLock);
+        return -1;
+    }
+
+    uint32_t framesAllocated = *(uint32_t *)(vdi->header + 388);
+    uint32_t newAllocated = framesAllocated;
+    uint32_t n = 0;
+    for (uint32_t page = 0; page < vdi->totalPages && n < count; page++) {
+        if (vdi->overlayMap[page] == VDI_OVERLAY_NONE) continue;
+        uint32_t frame = (vdi->map[page] < 0xFFFFFFFE) ? vdi->map[page] : newAllocated++;
+        entries[n++] = (CommitEntry){ page, vdi->overlayMap[page], frame };
+    }
+    qsort(entries, n, sizeof(CommitEntry), compareCommitFrames);
+
+    int baseFd = vdi->fd;
+    vdi->fd = rwFd;  // writePhysical() and writeMap() go to the writable descriptor
+    uint8_t *frame = (vdi->overlayFd == -1) ? NULL : bufferPoolGet(&vdi->framePool);
+    bool ok = (vdi->overlayFd == -1 || frame);
+    for (uint32_t i = 0; ok && i < n; i++) {
+        uint8_t *data = frame;
+        if (vdi->overlayFd == -1) {
+            data = vdi->overlayFrames[entries[i].slot];
+        } else if (pread(vdi->overlayFd, frame, vdi->pageSize, (off_t)entries[i].slot * vdi->pageSize) != (ssize_t)vdi->pageSize) {
+            ok = false;
+            break;
+        }
+        ok = writePhysical(vdi, data, vdi->pageSize, vdi->frameOffset + (off_t)entries[i].frame * vdi->pageSize) == (ssize_t)vdi->pageSize;
+    }
+    bufferPoolPut(&vdi->framePool, frame);
+    if (ok) ok = fsync(rwFd) == 0;  // Frames must be on disk before the map that points at them
+
+    if (ok && newAllocated != framesAllocated) {
+        memcpy(oldMap, vdi->map, vdi->totalPages * sizeof(uint32_t));
+        for (uint32_t i = 0; i < n; i++) vdi->map[entries[i].page] = entries[i].frame;
+        if (!writeMap(vdi, newAllocated)) {
+            memcpy(vdi->map, oldMap, vdi->totalPages * sizeof(uint32_t));
+            *(uint32_t *)(vdi->header + 388) = framesAllocated;
+            ok = false;
+        }
+    }
+    vdi->fd = baseFd;
+    close(rwFd);
+
+    if (ok) {
+        clearOverlay(vdi);
+    } else {
+        perror("Error committing overlay");
+    }
+    pthread_rwlock_unlock(&vdi->overlayLock);
+    free(entries);
+    free(oldMap);
+    return ok ? (int)n : -1;
+}
+
 // --- Change the logical position inside the VDI (similar to fseek) ---
 off_t vdiSeek(VDIFile *vdi, off_t offset, int anchor) {
     if (!vdi) return -1;
@@ -111,12 +585,12 @@ off_t vdiSeek(VDIFile *vdi, off_t offset, int anchor) {
     } else if (anchor == SEEK_CUR) {
         newCursor = vdi->cursor + offset; // Relative seek
     } else if (anchor == SEEK_END) {
-        newCursor = 134217728 + offset;   // Seek from end (assumed 128MB disk size)
+        newCursor = vdi->diskSize + offset; // Seek from end of the virtual disk
     } else {
         return -1;
     }
 
-    if (newCursor < 0 || newCursor > 134217728) return -1; // Check valid range
+    if (newCursor < 0 || (uint64_t)newCursor > vdi->diskSize) return -1; // Check valid range
 
     vdi->cursor = newCursor;
     return vdi->cursor;
@@ -124,18 +598,18 @@ off_t vdiSeek(VDIFile *vdi, off_t offset, int anchor) {
 
 // --- Translate logical offset into physical offset inside the file ---
 off_t vdiTranslate(VDIFile *vdi, off_t logicalOffset) {
+    if (logicalOffset < 0 || logicalOffset / vdi->pageSize >= vdi->totalPages) return -1; // Out of range
+
     uint32_t pageNum = logicalOffset / vdi->pageSize;  // Which page we're in
     uint32_t offsetInPage = logicalOffset % vdi->pageSize; // Offset inside that page
 
-    if (pageNum >= vdi->totalPages) return -1;    // Out of range
-
     uint32_t physicalPage = vdi->map[pageNum];     // Get mapped physical page number
 
-    if (physicalPage == 0xFFFFFFFF) {
-        return -1;  // Page is not allocated
+    if (physicalPage >= 0xFFFFFFFE) {
+        return -1;  // Page is not allocated (or is a known all-zero page)
     }
 
-    return (off_t)(physicalPage * vdi->pageSize + offsetInPage); // Calculate physical file offset
+    return vdi->frameOffset + (off_t)physicalPage * vdi->pageSize + offsetInPage; // Calculate physical file offset (64-bit)
 }
 
 // --- Print basic header info (signature, version, etc.) ---
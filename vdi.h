@@ -4,6 +4,16 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <stdatomic.h>
+#include "bufpool.h"
+
+#define VDI_OPEN_DIRECT 0x1    // vdiOpenFlags(): use O_DIRECT and aligned I/O instead of the page cache
+#define VDI_OPEN_SNAPSHOT 0x2  // vdiOpenFlags(): open read-only and keep writes in a copy-on-write overlay
+#define VDI_OVERLAY_NONE 0xFFFFFFFF  // overlayMap entry of a page that has not been written
+#define VDI_IMAGE_DYNAMIC 1    // Image type (header offset 76): frames are allocated on demand
+#define VDI_IMAGE_FIXED 2      // Image type: every page has a frame, in order
 
 // --- VDIHeader struct describes the layout of a VDI file header ---
 typedef struct {
@@ -36,6 +46,8 @@ typedef struct {
 } VDIHeader;
 
 // --- VDIFile struct holds an open VDI file and necessary metadata ---
+// One VDIFile is shared by every partition opened on the image: the fd, header and map are loaded
+// once and the struct is freed when the last reference is dropped with vdiClose().
 typedef struct {
     int fd;                 // File descriptor of the open VDI
     uint8_t header[400];     // Buffer to hold the first 400 bytes (header)
@@ -43,15 +55,39 @@ typedef struct {
     size_t cursor;           // Current logical position (for read/write operations)
     uint32_t pageSize;       // Size of each page (frame)
     uint32_t totalPages;     // Number of total pages/frames
+    off_t frameOffset;       // Offset where the data frames start in the file
+    off_t mapOffset;         // Offset where the translation map starts in the file
+    uint64_t diskSize;       // Size of the virtual disk in bytes
+    bool direct;             // File was opened with O_DIRECT
+    BufferPool framePool;    // Aligned bounce buffers for O_DIRECT reads and writes
+    atomic_int refCount;     // Owners of this image (vdiOpen() and each vdiRetain())
+
+    // Snapshot mode: the file is only read, written pages are copied whole into overlay slots
+    char *path;              // File name, for messages and for vdiCommitOverlay() when /proc is missing
+    uint32_t *overlayMap;    // Overlay slot of each page (VDI_OVERLAY_NONE if unwritten); NULL if not a snapshot
+    uint8_t **overlayFrames; // In-memory slots, when there is no side file
+    uint32_t overlaySlots;   // Slots in use
+    uint32_t overlayCapacity;// Length of overlayFrames
+    int overlayFd;           // Side file holding slot i at i * pageSize, or -1
+    pthread_rwlock_t overlayLock; // Shared by overlay readers, exclusive for writes, commit and drop
 } VDIFile;
 
 // --- Function declarations for operations on VDI files ---
 VDIFile *vdiOpen(const char *filename);    // Open a VDI file
-void vdiClose(VDIFile *vdi);                // Close a VDI file
+VDIFile *vdiOpenFlags(const char *filename, int flags); // Open a VDI file with VDI_OPEN_* options
+VDIFile *vdiOpenSnapshot(const char *filename, const char *overlayPath, int flags); // Snapshot whose overlay lives in a side file
+VDIFile *vdiRetain(VDIFile *vdi);           // Take another reference to an open VDI file
+void vdiClose(VDIFile *vdi);                // Drop a reference; the file is closed with the last one
 ssize_t vdiRead(VDIFile *vdi, void *buf, size_t count);    // Read bytes from VDI
 ssize_t vdiWrite(VDIFile *vdi, void *buf, size_t count);   // Write bytes to VDI
+ssize_t vdiReadAt(VDIFile *vdi, void *buf, size_t count, off_t offset); // Read bytes at a logical offset without moving the cursor
+ssize_t vdiWriteAt(VDIFile *vdi, void *buf, size_t count, off_t offset); // Write bytes at a logical offset without moving the cursor
 off_t vdiSeek(VDIFile *vdi, off_t offset, int anchor);     // Seek inside the VDI
 off_t vdiTranslate(VDIFile *vdi, off_t logicalOffset);     // Translate logical offset to physical offset
+int vdiDiscardPages(VDIFile *vdi, const uint8_t *discard, bool compact); // Unmap pages and give their frames back to the host
+uint32_t vdiOverlayPages(VDIFile *vdi);     // Pages written to a snapshot's overlay so far
+int vdiCommitOverlay(VDIFile *vdi);         // Write the overlay into the base file in one pass; pages written or -1
+void vdiDropOverlay(VDIFile *vdi);          // Forget every write made to a snapshot
 void displayVDIHeader(VDIFile *vdi);       // Display the parsed VDI header
 void displayVDITranslationMap(VDIFile *vdi);// Display translation map
 void displayMBR(VDIFile *vdi);              // Display Master Boot Record
@@ -0,0 +1,419 @@
+#include "walk.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WALK_OUTPUT_BUFFER 65536  // Worker output is handed to the stream once it grows past this
+#define WALK_DEQUE_INITIAL 64     // Starting capacity of each worker's queue
+
+// A directory waiting to be listed
+typedef struct {
+    uint32_t iNum;
+    char *path;
+} WalkItem;
+
+// Per-worker double-ended queue: the owner works at the tail, thieves take from the head
+typedef struct {
+    pthread_mutex_t lock;
+    WalkItem *items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} WalkDeque;
+
+typedef struct {
+    struct Ext2File *f;
+    ManifestFormat format;
+    FILE *out;
+    pthread_mutex_t outLock;
+    WalkVisitor visit;      // When set, entries go to the visitor instead of the manifest
+    void *visitArg;
+    int numWorkers;
+    WalkDeque *deques;
+    atomic_size_t pending;  // Directories queued or being listed; the walk is over when it drops to zero
+    atomic_size_t queued;   // Directories sitting in a deque, waiting for a worker
+    atomic_int sleepers;    // Workers parked on idleCond
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;  // Signalled when a directory is queued and when the walk ends
+    atomic_uchar *visited;  // One bit per inode: directories already queued, so a loop on a corrupt image ends
+    atomic_bool failed;
+} WalkContext;
+
+typedef struct {
+    WalkContext *ctx;
+    int id;
+    pthread_t thread;
+    uint8_t *block;   // Scratch block for directory data
+    char *outBuf;     // Records not yet written to the stream
+    size_t outLen;
+    size_t outCap;
+} WalkWorker;
+
+static bool dequePush(WalkDeque *d, WalkItem item) {
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->capacity) {
+        size_t newCap = d->capacity ? d->capacity * 2 : WALK_DEQUE_INITIAL;
+        WalkItem *items = malloc(newCap * sizeof(WalkItem));
+        if (!items) {
+            pthread_mutex_unlock(&d->lock);
+            return false;
+        }
+        for (size_t i = 0; i < d->count; i++) items[i] = d->items[(d->head + i) % d->capacity]; // Unwrap the ring
+        free(d->items);
+        d->items = items;
+        d->head = 0;
+        d->capacity = newCap;
+    }
+    d->items[(d->head + d->count) % d->capacity] = item;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+    return true;
+}
+
+// Owner side: take the most recently pushed directory (keeps the walk depth-first and the queues short)
+static bool dequePop(WalkDeque *d, WalkItem *item) {
+    pthread_mutex_lock(&d->lock);
+    bool found = d->count > 0;
+    if (found) {
+        d->count--;
+        *item = d->items[(d->head + d->count) % d->capacity];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+// Thief side: take the oldest directory, which tends to have the largest subtree below it
+static bool dequeSteal(WalkDeque *d, WalkItem *item) {
+    pthread_mutex_lock(&d->lock);
+    bool found = d->count > 0;
+    if (found) {
+        *item = d->items[d->head];
+        d->head = (d->head + 1) % d->capacity;
+        d->count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static bool stealWork(WalkContext *ctx, int self, WalkItem *item) {
+    for (int i = 1; i < ctx->numWorkers; i++) {
+        if (dequeSteal(&ctx->deques[(self + i) % ctx->numWorkers], item)) return true;
+    }
+    return false;
+}
+
+// Queue a directory on a worker's deque and wake one parked worker to take it
+static bool queueDirectory(WalkContext *ctx, int id, WalkItem item) {
+    if (!dequePush(&ctx->deques[id], item)) return false;
+    atomic_fetch_add(&ctx->queued, 1);
+    if (atomic_load(&ctx->sleepers) > 0) {  // Parked workers count themselves before checking queued
+        pthread_mutex_lock(&ctx->idleLock);
+        pthread_cond_signal(&ctx->idleCond);
+        pthread_mutex_unlock(&ctx->idleLock);
+    }
+    return true;
+}
+
+static bool takeDirectory(WalkContext *ctx, int id, WalkItem *item) {
+    if (!dequePop(&ctx->deques[id], item) && !stealWork(ctx, id, item)) return false;
+    atomic_fetch_sub(&ctx->queued, 1);
+    return true;
+}
+
+// A directory has been listed; the last one wakes every parked worker so they can exit
+static void finishDirectory(WalkContext *ctx) {
+    if (atomic_fetch_sub(&ctx->pending, 1) == 1) {
+        pthread_mutex_lock(&ctx->idleLock);
+        pthread_cond_broadcast(&ctx->idleCond);
+        pthread_mutex_unlock(&ctx->idleLock);
+    }
+}
+
+// Park until a directory is queued somewhere or the walk is over
+static void waitForWork(WalkContext *ctx) {
+    pthread_mutex_lock(&ctx->idleLock);
+    atomic_fetch_add(&ctx->sleepers, 1);
+    while (atomic_load(&ctx->queued) == 0 && atomic_load(&ctx->pending) != 0) {
+        pthread_cond_wait(&ctx->idleCond, &ctx->idleLock);
+    }
+    atomic_fetch_sub(&ctx->sleepers, 1);
+    pthread_mutex_unlock(&ctx->idleLock);
+}
+
+static void flushOutput(WalkWorker *w) {
+    if (w->outLen == 0) return;
+    pthread_mutex_lock(&w->ctx->outLock);
+    fwrite(w->outBuf, 1, w->outLen, w->ctx->out);
+    pthread_mutex_unlock(&w->ctx->outLock);
+    w->outLen = 0;
+}
+
+// Make room for n more bytes of output
+static bool reserveOutput(WalkWorker *w, size_t n) {
+    if (w->outLen + n <= w->outCap) return true;
+    flushOutput(w);
+    if (n <= w->outCap) return true;
+    char *buf = realloc(w->outBuf, n);
+    if (!buf) return false;
+    w->outBuf = buf;
+    w->outCap = n;
+    return true;
+}
+
+// Append a path, quoted or escaped for the manifest format
+static void appendPath(WalkWorker *w, const char *path, ManifestFormat format) {
+    char *p = w->outBuf + w->outLen;
+    if (format == MANIFEST_JSONL) {
+        *p++ = '"';
+        for (const unsigned char *s = (const unsigned char *)path; *s; s++) {
+            if (*s == '"' || *s == '\\') {
+                *p++ = '\\';
+                *p++ = *s;
+            } else if (*s < 0x20) {
+                p += sprintf(p, "\\u%04x", *s);
+            } else {
+                *p++ = *s;
+            }
+        }
+        *p++ = '"';
+    } else if (strpbrk(path, ",\"\r\n")) {
+        *p++ = '"';
+        for (const char *s = path; *s; s++) {
+            if (*s == '"') *p++ = '"';  // CSV doubles embedded quotes
+            *p++ = *s;
+        }
+        *p++ = '"';
+    } else {
+        size_t len = strlen(path);
+        memcpy(p, path, len);
+        p += len;
+    }
+    w->outLen = p - w->outBuf;
+}
+
+static void emitRecord(WalkWorker *w, const char *path, uint32_t iNum, Ext2Inode *inode) {
+    WalkContext *ctx = w->ctx;
+    if (!reserveOutput(w, strlen(path) * 6 + 160)) {  // Worst case every byte escapes to \u00XX
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    uint32_t blocks = inode->i_blocks / (ctx->f->blockSize / 512);
+    if (ctx->format == MANIFEST_JSONL) {
+        w->outLen += sprintf(w->outBuf + w->outLen, "{\"path\":");
+        appendPath(w, path, ctx->format);
+        w->outLen += sprintf(w->outBuf + w->outLen,
+                             ",\"inode\":%u,\"size\":%llu,\"mode\":\"%06o\",\"mtime\":%u,\"blocks\":%u}\n",
+                             iNum, (unsigned long long)fileSize(inode), inode->i_mode, inode->i_mtime, blocks);
+    } else {
+        appendPath(w, path, ctx->format);
+        w->outLen += sprintf(w->outBuf + w->outLen, ",%u,%llu,%06o,%u,%u\n",
+                             iNum, (unsigned long long)fileSize(inode), inode->i_mode, inode->i_mtime, blocks);
+    }
+}
+
+static void reportEntry(WalkWorker *w, const char *path, uint32_t iNum, Ext2Inode *inode) {
+    if (w->ctx->visit) {
+        w->ctx->visit(w->ctx->visitArg, path, iNum, inode);
+    } else {
+        emitRecord(w, path, iNum, inode);
+    }
+}
+
+// Mark a directory inode as queued; false if it was queued before (or is not a valid inode number)
+static bool claimDirectory(WalkContext *ctx, uint32_t iNum) {
+    if (iNum == 0 || iNum > ctx->f->superblock.s_inodes_count) return false;
+    uint8_t bit = 1 << ((iNum - 1) % 8);
+    return !(atomic_fetch_or(&ctx->visited[(iNum - 1) / 8], bit) & bit);
+}
+
+static char *joinPath(const char *parent, const char *name, size_t nameLen) {
+    size_t parentLen = strlen(parent);
+    bool atRoot = parentLen == 1;  // Parent is "/"
+    char *path = malloc(parentLen + nameLen + 2);
+    if (!path) return NULL;
+    memcpy(path, parent, parentLen);
+    size_t pos = parentLen;
+    if (!atRoot) path[pos++] = '/';
+    memcpy(path + pos, name, nameLen);
+    path[pos + nameLen] = '\0';
+    return path;
+}
+
+// List one directory: emit a record for every entry and queue the subdirectories
+static void processDirectory(WalkWorker *w, WalkItem *item) {
+    WalkContext *ctx = w->ctx;
+    struct Ext2File *f = ctx->f;
+    Ext2Inode dir;
+
+    if (!fetchInode(f, item->iNum, &dir)) {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    uint32_t numBlocks = (dir.i_size + f->blockSize - 1) / f->blockSize;
+    for (uint32_t b = 0; b < numBlocks; b++) {
+        if (!fetchBlockFromFile(f, &dir, b, w->block)) {
+            atomic_store(&ctx->failed, true);
+            return;
+        }
+
+        uint32_t offset = 0;
+        while (offset + 8 <= f->blockSize) {
+            Ext2DirEntry *entry = (Ext2DirEntry *)(w->block + offset);
+            if (entry->rec_len < 8 || offset + entry->rec_len > f->blockSize) break; // Corrupt entry, skip rest of block
+            offset += entry->rec_len;
+
+            if (entry->inode == 0) continue;  // Unused slot
+            if (8 + entry->name_len > entry->rec_len) continue;  // Corrupt entry, the name runs past its record
+            if (entry->name[0] == '.' && (entry->name_len == 1 || (entry->name_len == 2 && entry->name[1] == '.')))
+                continue;
+
+            Ext2Inode child;
+            if (!fetchInode(f, entry->inode, &child)) {
+                atomic_store(&ctx->failed, true);
+                continue;
+            }
+            char *path = joinPath(item->path, entry->name, entry->name_len);
+            if (!path) {
+                atomic_store(&ctx->failed, true);
+                continue;
+            }
+            reportEntry(w, path, entry->inode, &child);
+
+            if ((child.i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR && !claimDirectory(ctx, entry->inode)) {
+                fprintf(stderr, "Directory inode %u reached again at %s, not descending\n", entry->inode, path);
+                atomic_store(&ctx->failed, true);
+                free(path);
+            } else if ((child.i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR) {
+                WalkItem sub = { entry->inode, path };
+                atomic_fetch_add(&ctx->pending, 1);  // Count it before anyone can steal and finish it
+                if (!queueDirectory(ctx, w->id, sub)) {
+                    atomic_fetch_sub(&ctx->pending, 1);
+                    atomic_store(&ctx->failed, true);
+                    free(path);
+                }
+            } else {
+                free(path);
+            }
+        }
+    }
+}
+
+static void *walkWorker(void *arg) {
+    WalkWorker *w = (WalkWorker *)arg;
+    WalkContext *ctx = w->ctx;
+
+    for (;;) {
+        WalkItem item;
+        if (takeDirectory(ctx, w->id, &item)) {
+            processDirectory(w, &item);
+            free(item.path);
+            finishDirectory(ctx);
+        } else if (atomic_load(&ctx->pending) == 0) {
+            break;
+        } else {
+            waitForWork(ctx);  // Others are still listing directories that may produce work
+        }
+    }
+    flushOutput(w);
+    return NULL;
+}
+
+// Run the workers over a context whose output side (manifest or visitor) is already filled in
+static bool walkTree(WalkContext *base, int numThreads) {
+    if (numThreads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = (cores > 0) ? (int)cores : 1;
+    }
+
+    WalkContext ctx = *base;
+    struct Ext2File *f = ctx.f;
+    ctx.numWorkers = numThreads;
+    atomic_init(&ctx.pending, 0);
+    atomic_init(&ctx.queued, 0);
+    atomic_init(&ctx.sleepers, 0);
+    atomic_init(&ctx.failed, false);
+    pthread_mutex_init(&ctx.outLock, NULL);
+    pthread_mutex_init(&ctx.idleLock, NULL);
+    pthread_cond_init(&ctx.idleCond, NULL);
+
+    ctx.deques = calloc(numThreads, sizeof(WalkDeque));
+    WalkWorker *workers = calloc(numThreads, sizeof(WalkWorker));
+    ctx.visited = calloc(f->superblock.s_inodes_count / 8 + 1, sizeof(atomic_uchar));
+    if (!ctx.deques || !workers || !ctx.visited) {
+        fprintf(stderr, "Failed to allocate walker state\n");
+        free(ctx.deques);
+        free(workers);
+        free(ctx.visited);
+        pthread_mutex_destroy(&ctx.outLock);
+        pthread_mutex_destroy(&ctx.idleLock);
+        pthread_cond_destroy(&ctx.idleCond);
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < numThreads; i++) {
+        pthread_mutex_init(&ctx.deques[i].lock, NULL);
+        workers[i].ctx = &ctx;
+        workers[i].id = i;
+        workers[i].block = bufferPoolGet(&f->blockPool);
+        workers[i].outCap = WALK_OUTPUT_BUFFER;
+        workers[i].outBuf = malloc(WALK_OUTPUT_BUFFER);
+        if (!workers[i].block || !workers[i].outBuf) ok = false;
+    }
+
+    // Seed the walk with the root directory, which gets its own record
+    Ext2Inode root;
+    char *rootPath = strdup("/");
+    if (ok && rootPath && fetchInode(f, EXT2_ROOT_INO, &root)) {
+        reportEntry(&workers[0], rootPath, EXT2_ROOT_INO, &root);
+        claimDirectory(&ctx, EXT2_ROOT_INO);
+        WalkItem item = { EXT2_ROOT_INO, rootPath };
+        atomic_store(&ctx.pending, 1);
+        queueDirectory(&ctx, 0, item);
+
+        int started = 0;
+        for (int i = 0; i < numThreads; i++) {
+            if (pthread_create(&workers[i].thread, NULL, walkWorker, &workers[i]) != 0) break;
+            started++;
+        }
+        if (started == 0) {
+            walkWorker(&workers[0]);  // No threads available, walk on this one
+        } else {
+            for (int i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+        }
+    } else {
+        fprintf(stderr, "Failed to start the walk at the root directory\n");
+        free(rootPath);
+        ok = false;
+    }
+    if (ctx.out) fflush(ctx.out);
+
+    for (int i = 0; i < numThreads; i++) {
+        bufferPoolPut(&f->blockPool, workers[i].block);
+        free(workers[i].outBuf);
+        free(ctx.deques[i].items);
+        pthread_mutex_destroy(&ctx.deques[i].lock);
+    }
+    free(workers);
+    free(ctx.deques);
+    free(ctx.visited);
+    pthread_mutex_destroy(&ctx.outLock);
+    pthread_mutex_destroy(&ctx.idleLock);
+    pthread_cond_destroy(&ctx.idleCond);
+
+    return ok && !atomic_load(&ctx.failed);
+}
+
+bool walkExt2(struct Ext2File *f, int numThreads, ManifestFormat format, FILE *out) {
+    WalkContext ctx = { .f = f, .format = format, .out = out };
+    return walkTree(&ctx, numThreads);
+}
+
+bool walkExt2Visit(struct Ext2File *f, int numThreads, WalkVisitor visit, void *arg) {
+    WalkContext ctx = { .f = f, .visit = visit, .visitArg = arg };
+    return walkTree(&ctx, numThreads);
+}
@@ -0,0 +1,24 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include "ext2.h"
+#include <stdio.h>
+
+// Output formats for the file system manifest
+typedef enum {
+    MANIFEST_CSV,   // path,inode,size,mode,mtime,blocks
+    MANIFEST_JSONL  // One JSON object per line
+} ManifestFormat;
+
+// Walk the whole tree from the root inode using numThreads workers (0 = one per core)
+// and stream one manifest record per file to out. Returns false if any directory could not be read.
+// Problems are reported on stderr, so out only ever holds records.
+bool walkExt2(struct Ext2File *f, int numThreads, ManifestFormat format, FILE *out);
+
+// Called once per entry (root included) from whichever worker listed its directory, so it must be thread-safe
+typedef void (*WalkVisitor)(void *arg, const char *path, uint32_t iNum, Ext2Inode *inode);
+
+// Same walk as walkExt2(), but hands every entry to visit instead of writing a manifest
+bool walkExt2Visit(struct Ext2File *f, int numThreads, WalkVisitor visit, void *arg);
+
+#endif